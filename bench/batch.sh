@@ -0,0 +1,43 @@
+#!/bin/sh
+# Compare running N commands as separate processes against a single
+# posixy --batch run
+# Usage: batch.sh path-to-posixy [count]
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-2000}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+i=0
+while [ $i -lt $COUNT ]
+do
+    echo "basename /usr/share/doc/file$i.txt .txt"
+    echo "dirname /usr/share/doc/file$i.txt"
+    echo "true"
+    i=$((i + 1))
+done > "$WORKDIR/commands"
+
+COMMANDS=$(wc -l < "$WORKDIR/commands")
+
+START=$(now_ns)
+while read -r CMD ARGS
+do
+    "$POSIXY" $CMD $ARGS
+done < "$WORKDIR/commands" > /dev/null
+END=$(now_ns)
+EXEC_NS=$((END - START))
+
+START=$(now_ns)
+"$POSIXY" --batch "$WORKDIR/commands" > /dev/null
+END=$(now_ns)
+BATCH_NS=$((END - START))
+
+echo "{\"benchmark\": \"batch\", \"commands\": $COMMANDS," \
+     "\"exec_ns_per_command\": $((EXEC_NS / COMMANDS))," \
+     "\"batch_ns_per_command\": $((BATCH_NS / COMMANDS))}"
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Compare the throughput and page cache footprint of the cat copy methods
+# Usage: cat-mmap.sh path-to-posixy [size-in-MiB]
+#
+# The page cache footprint is measured with fincore(1) from util-linux. The
+# cache is only dropped before each run when running as root, otherwise the
+# input starts out warm and the footprint of both methods is the full file.
+#
+# The output goes through a pipe rather than straight to /dev/null, since
+# writing to /dev/null never reads the mapped pages.
+
+set -eu
+
+POSIXY="$1"
+SIZE_MB="${2:-512}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+cached_bytes() {
+    if command -v fincore > /dev/null 2>&1; then
+        fincore --bytes --noheadings --output RES "$1" | tr -d ' '
+    else
+        echo null
+    fi
+}
+
+drop_cache() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 1 > /proc/sys/vm/drop_caches
+    fi
+}
+
+dd if=/dev/urandom of="$WORKDIR/input" bs=1M count=$SIZE_MB 2>/dev/null
+
+for METHOD in read/write mmap
+do
+    drop_cache
+    START=$(now_ns)
+    POSIXY_CAT_METHOD=$METHOD "$POSIXY" cat "$WORKDIR/input" | \
+        "$POSIXY" cat > /dev/null
+    END=$(now_ns)
+
+    echo "{\"benchmark\": \"cat-mmap\", \"method\": \"$METHOD\"," \
+         "\"bytes\": $((SIZE_MB * 1048576))," \
+         "\"mb_per_sec\": $((SIZE_MB * 1000000000 / (END - START + 1)))," \
+         "\"cached_bytes_after\": $(cached_bytes "$WORKDIR/input")}"
+done
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Measure what the prefetch threads in cat cost or save for a few to many
+# operands, with the default, with them forced off and with them forced on
+# Usage: cat-prefetch.sh path-to-posixy [runs] [size-in-bytes]
+#
+# The files stay in the page cache, so this is mostly the cost of starting
+# and joining the threads, which matters most for short runs like cat a b.
+# cat-shards.sh covers a cold cache.
+
+set -eu
+
+POSIXY="$1"
+RUNS="${2:-200}"
+SIZE="${3:-4000}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+i=0
+while [ $i -lt 512 ]
+do
+    head -c $SIZE /dev/urandom > "$WORKDIR/file-$i"
+    i=$((i + 1))
+done
+
+# Usage: run operands prefetch, where prefetch is empty for the default
+run() {
+    OPERANDS=$(i=0; while [ $i -lt $1 ]; do
+                echo "$WORKDIR/file-$i"; i=$((i + 1)); done)
+
+    i=0
+    START=$(now_ns)
+    while [ $i -lt $RUNS ]
+    do
+        if [ -z "$2" ]; then
+            "$POSIXY" cat $OPERANDS > /dev/null
+        else
+            POSIXY_CAT_PREFETCH=$2 "$POSIXY" cat $OPERANDS > /dev/null
+        fi
+        i=$((i + 1))
+    done
+    END=$(now_ns)
+
+    echo "{\"benchmark\": \"cat-prefetch\", \"files\": $1," \
+         "\"prefetch\": \"${2:-default}\", \"runs\": $RUNS," \
+         "\"us_per_run\": $(((END - START) / 1000 / RUNS))}"
+}
+
+for FILES in 2 8 64 512
+do
+    run $FILES ""
+    run $FILES 0
+    run $FILES 4
+done
@@ -0,0 +1,60 @@
+#!/bin/sh
+# Time cat over many small files, with and without the prefetch threads,
+# and with the io_uring engine
+# Usage: cat-shards.sh path-to-posixy [count] [size-in-bytes]
+#
+# Each configuration is timed with a cold and a warm page cache. The cache
+# can only be dropped when running as root, otherwise both runs are warm.
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-5000}"
+SIZE="${3:-20000}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+drop_cache() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 1 > /proc/sys/vm/drop_caches
+    fi
+}
+
+i=0
+while [ $i -lt $COUNT ]
+do
+    head -c $SIZE /dev/urandom > "$WORKDIR/shard-$i"
+    i=$((i + 1))
+done
+
+run() {
+    CACHE=$1
+    METHOD=$2
+    PREFETCH=$3
+
+    if [ $CACHE = cold ]; then
+        drop_cache
+    fi
+
+    START=$(now_ns)
+    POSIXY_CAT_METHOD=$METHOD POSIXY_CAT_PREFETCH=$PREFETCH \
+        "$POSIXY" cat "$WORKDIR"/shard-* | "$POSIXY" cat > /dev/null
+    END=$(now_ns)
+
+    echo "{\"benchmark\": \"cat-shards\", \"files\": $COUNT," \
+         "\"cache\": \"$CACHE\", \"method\": \"${METHOD:-auto}\"," \
+         "\"prefetch_threads\": $PREFETCH," \
+         "\"ms\": $(((END - START) / 1000000))}"
+}
+
+for CACHE in cold warm
+do
+    run $CACHE "" 0
+    run $CACHE "" 4
+    run $CACHE io_uring 0
+done
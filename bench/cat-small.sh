@@ -0,0 +1,52 @@
+#!/bin/sh
+# Count the system calls and time taken by cat over many small files, with
+# and without batching their output into fewer writes
+# Usage: cat-small.sh path-to-posixy [count] [size-in-bytes]
+#
+# The system calls are counted by the kernel, and reported by cat when
+# POSIXY_CAT_SYSCALLS is set. Every read or write family call counts,
+# including sendfile and copy_file_range.
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-5000}"
+SIZE="${3:-2000}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+i=0
+while [ $i -lt $COUNT ]
+do
+    head -c $SIZE /dev/urandom > "$WORKDIR/small-$i"
+    i=$((i + 1))
+done
+
+for OUTPUT in pipe file
+do
+    for COALESCE in 0 1
+    do
+        START=$(now_ns)
+        if [ $OUTPUT = pipe ]; then
+            POSIXY_CAT_SYSCALLS=1 POSIXY_CAT_COALESCE=$COALESCE \
+                "$POSIXY" cat "$WORKDIR"/small-* 2> "$WORKDIR/stats" | \
+                "$POSIXY" cat > /dev/null
+        else
+            POSIXY_CAT_SYSCALLS=1 POSIXY_CAT_COALESCE=$COALESCE \
+                "$POSIXY" cat "$WORKDIR"/small-* 2> "$WORKDIR/stats" \
+                > "$WORKDIR/output"
+        fi
+        END=$(now_ns)
+
+        # cat: syscalls: N reads, M writes
+        set -- $(tail -n 1 "$WORKDIR/stats")
+        echo "{\"benchmark\": \"cat-small\", \"files\": $COUNT," \
+             "\"output\": \"$OUTPUT\", \"coalesce\": $COALESCE," \
+             "\"read_syscalls\": $3, \"write_syscalls\": $5," \
+             "\"ms\": $(((END - START) / 1000000))}"
+    done
+done
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Sweep the I/O buffer ceiling and measure cat and tee throughput
+# Usage: iobuf.sh path-to-posixy [size-in-MiB]
+
+set -eu
+
+POSIXY="$1"
+SIZE_MB="${2:-256}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+# Report MB/s for the given command, run with the buffer ceiling set
+measure() {
+    NAME="$1"
+    MAX="$2"
+    shift 2
+
+    START=$(now_ns)
+    POSIXY_IOBUF_MAX=$MAX "$@"
+    END=$(now_ns)
+
+    echo "{\"benchmark\": \"iobuf\", \"test\": \"$NAME\"," \
+         "\"iobuf_max\": \"$MAX\", \"bytes\": $((SIZE_MB * 1048576))," \
+         "\"mb_per_sec\": $((SIZE_MB * 1000000000 / (END - START + 1)))}"
+}
+
+dd if=/dev/urandom of="$WORKDIR/input" bs=1M count=$SIZE_MB 2>/dev/null
+
+for MAX in 4K 16K 64K 128K 256K 1M 4M 16M
+do
+    # /dev/null is not a regular file, so cat uses its read/write loop
+    measure cat-file-devnull $MAX \
+        sh -c '"$0" cat "$1" > /dev/null' "$POSIXY" "$WORKDIR/input"
+    measure tee-file-devnull $MAX \
+        sh -c '"$0" tee < "$1" > /dev/null' "$POSIXY" "$WORKDIR/input"
+    measure tee-file-pipe $MAX \
+        sh -c '"$0" tee < "$1" | "$0" cat > /dev/null' "$POSIXY" "$WORKDIR/input"
+    measure tee-file-file $MAX \
+        sh -c '"$0" tee "$2" < "$1" > /dev/null' "$POSIXY" "$WORKDIR/input" \
+        "$WORKDIR/output"
+done
@@ -0,0 +1,60 @@
+#!/bin/sh
+# Time each of the ways logname finds the login name, as separate processes
+# and in posixy --batch, where the passwd mapping and its index are reused
+# Usage: logname.sh path-to-posixy [count]
+#
+# The passwd method needs the audit login uid. If it isn't set, as in many
+# containers, this tries to set it to the current uid, which needs root.
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-200}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+if [ "$(cat /proc/self/loginuid 2>/dev/null)" = 4294967295 ]; then
+    # echo is built in, the kernel only lets a process set its own
+    echo "$(id -u)" > /proc/self/loginuid 2>/dev/null || true
+fi
+
+i=0
+while [ $i -lt $COUNT ]
+do
+    echo logname
+    i=$((i + 1))
+done > "$WORKDIR/commands"
+
+# HANDLER50 and HANDLER99 are in microseconds
+report() {
+    "$POSIXY" trace-report "$WORKDIR/trace" |
+    awk -v method=$1 -v mode=$2 -v count=$COUNT '
+        $1 == "logname" {
+            printf "{\"benchmark\": \"logname\", \"method\": \"%s\", " \
+                   "\"mode\": \"%s\", \"count\": %d, \"handler_p50_us\": " \
+                   "%.1f, \"handler_p99_us\": %.1f}\n",
+                   method, mode, count, $5, $6
+        }'
+}
+
+for METHOD in passwd getlogin
+do
+    export POSIXY_LOGNAME_METHOD=$METHOD
+    if ! "$POSIXY" logname > /dev/null 2>&1; then
+        echo "{\"benchmark\": \"logname\", \"method\": \"$METHOD\"," \
+             "\"error\": \"no login name\"}"
+        continue
+    fi
+
+    rm -f "$WORKDIR/trace"
+    while read -r COMMAND
+    do
+        POSIXY_TRACE="$WORKDIR/trace" "$POSIXY" $COMMAND
+    done < "$WORKDIR/commands" > /dev/null
+    report $METHOD process
+
+    rm -f "$WORKDIR/trace"
+    POSIXY_TRACE="$WORKDIR/trace" "$POSIXY" --batch "$WORKDIR/commands" \
+        > /dev/null
+    report $METHOD batch
+done
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Measure the rate of basename and dirname over paths streamed on stdin,
+# for short paths like those from find over a source tree, and for deep
+# paths with long components
+# Usage: path-stream.sh path-to-posixy [count]
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-5000000}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+awk -v count=$COUNT 'BEGIN {
+    for (i = 0; i < count; i++) {
+        printf "./src/module%d/sub%d/file%d.c\n", i % 97, i % 13, i
+    }
+}' > "$WORKDIR/short"
+
+awk -v count=$((COUNT / 5)) 'BEGIN {
+    for (i = 0; i < count; i++) {
+        printf "/srv/archive/customer_accounts_with_long_names_%d/" \
+               "quarterly_reports_for_the_region_number_%d//" \
+               "attachment_%d_with_a_rather_long_descriptive_name.tar.gz\n",
+               i % 97, i % 13, i
+    }
+}' > "$WORKDIR/deep"
+
+for SHAPE in short deep
+do
+    tr '\n' '\0' < "$WORKDIR/$SHAPE" > "$WORKDIR/$SHAPE.0"
+    PATHS=$(wc -l < "$WORKDIR/$SHAPE")
+    BYTES=$(wc -c < "$WORKDIR/$SHAPE")
+
+    for COMMAND in basename dirname
+    do
+        for FRAMING in newline nul
+        do
+            if [ $FRAMING = nul ]; then
+                INPUT="$WORKDIR/$SHAPE.0"
+                FLAGS=-z
+            else
+                INPUT="$WORKDIR/$SHAPE"
+                FLAGS=
+            fi
+
+            START=$(now_ns)
+            "$POSIXY" $COMMAND $FLAGS < "$INPUT" > /dev/null
+            END=$(now_ns)
+            NS=$((END - START))
+
+            echo "{\"benchmark\": \"path-stream\", \"shape\": \"$SHAPE\"," \
+                 "\"command\": \"$COMMAND\", \"framing\": \"$FRAMING\"," \
+                 "\"paths\": $PATHS, \"bytes\": $BYTES, \"ns\": $NS," \
+                 "\"paths_per_sec\": $((PATHS * 1000000000 / NS))}"
+        done
+    done
+done
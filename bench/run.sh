@@ -0,0 +1,56 @@
+#!/bin/sh
+# Run the benchmark suite, as make bench does, writing a JSON object per
+# line to stdout, starting with one describing the host
+# Usage: run.sh path-to-posixy [scenario...]
+#
+# The scenarios are startup, throughput, small-files, tee-fanout, sleep and
+# wc, and all of them are run if none are given. BENCH_SIZE_MB sets the
+# largest size copied by throughput, the size streamed by tee-fanout and the
+# size of the file counted by wc.
+
+set -eu
+
+BENCHDIR=$(dirname "$0")
+POSIXY="$1"
+shift
+SIZE_MB="${BENCH_SIZE_MB:-1024}"
+
+if [ $# -eq 0 ]; then
+    set -- startup throughput small-files tee-fanout sleep wc
+fi
+
+# The text size is what start-up has to fault in, and what --enable-lto and
+# --enable-pgo change
+TEXT_BYTES=null
+if command -v size > /dev/null; then
+    TEXT_BYTES=$(size "$POSIXY" | awk 'NR == 2 { print $1 }')
+fi
+
+echo "{\"benchmark\": \"host\", \"kernel\": \"$(uname -r)\"," \
+     "\"machine\": \"$(uname -m)\", \"cpus\": $(getconf _NPROCESSORS_ONLN)," \
+     "\"posixy_bytes\": $(wc -c < "$POSIXY"), \"posixy_text_bytes\": $TEXT_BYTES}"
+
+for SCENARIO
+do
+    case $SCENARIO in
+        startup)
+            sh "$BENCHDIR/startup.sh" "$POSIXY" ;;
+        throughput)
+            sh "$BENCHDIR/throughput.sh" "$POSIXY" "$SIZE_MB" ;;
+        small-files)
+            sh "$BENCHDIR/cat-small.sh" "$POSIXY" ;;
+        tee-fanout)
+            # With stdout, tee writes to 1 to 32 sinks
+            for PIPES in 0 1 3 7 15 31
+            do
+                sh "$BENCHDIR/tee-fanout.sh" "$POSIXY" "$SIZE_MB" $PIPES
+            done ;;
+        sleep)
+            sh "$BENCHDIR/sleep-jitter.sh" "$POSIXY" ;;
+        wc)
+            sh "$BENCHDIR/wc.sh" "$POSIXY" "$SIZE_MB" ;;
+        *)
+            echo "run.sh: Unknown scenario $SCENARIO" >&2
+            exit 1 ;;
+    esac
+done
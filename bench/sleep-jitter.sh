@@ -0,0 +1,41 @@
+#!/bin/sh
+# Measure how far sleep overshoots short durations, with and without the
+# low-jitter mode. The sleeps are run with posixy --batch, so that process
+# start-up doesn't count, and timed with POSIXY_TRACE.
+# Usage: sleep-jitter.sh path-to-posixy [count]
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-500}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+for DURATION in 0.0001 0.001 0.01
+do
+    i=0
+    while [ $i -lt $COUNT ]
+    do
+        echo "sleep $DURATION"
+        i=$((i + 1))
+    done > "$WORKDIR/commands"
+
+    for SPIN in 0 100
+    do
+        rm -f "$WORKDIR/trace"
+        POSIXY_SLEEP_SPIN=$SPIN POSIXY_TRACE="$WORKDIR/trace" \
+            "$POSIXY" --batch "$WORKDIR/commands"
+
+        # HANDLER50 and HANDLER99 are in microseconds
+        "$POSIXY" trace-report "$WORKDIR/trace" |
+        awk -v duration=$DURATION -v spin=$SPIN -v count=$COUNT '
+            $1 == "sleep" {
+                target = duration * 1e6
+                printf "{\"benchmark\": \"sleep-jitter\", " \
+                       "\"duration_us\": %.0f, \"spin_us\": %d, " \
+                       "\"count\": %d, \"overshoot_p50_us\": %.1f, " \
+                       "\"overshoot_p99_us\": %.1f}\n",
+                       target, spin, count, $5 - target, $6 - target
+            }'
+    done
+done
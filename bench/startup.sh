@@ -0,0 +1,68 @@
+#!/bin/sh
+# Measure the time from exec to exit of each utility, run through a link to
+# posixy as when installed, against the same utility from coreutils
+# Usage: startup.sh path-to-posixy [count]
+#
+# The coreutils programs are looked up in /usr/bin and /bin, and any that
+# are missing are left out. Every run has its input and output on
+# /dev/null, so the time is almost all start-up and exit.
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-1000}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+case "$POSIXY" in
+    /*) ;;
+    *) POSIXY="$PWD/$POSIXY" ;;
+esac
+
+# Usage: run implementation program arguments...
+run() {
+    IMPLEMENTATION=$1
+    PROGRAM=$2
+    shift 2
+
+    i=0
+    START=$(now_ns)
+    while [ $i -lt $COUNT ]
+    do
+        "$PROGRAM" "$@" < /dev/null > /dev/null
+        i=$((i + 1))
+    done
+    END=$(now_ns)
+
+    echo "{\"benchmark\": \"startup\", \"command\": \"${PROGRAM##*/}\"," \
+         "\"implementation\": \"$IMPLEMENTATION\", \"count\": $COUNT," \
+         "\"us_per_run\": $(((END - START) / 1000 / COUNT))}"
+}
+
+for COMMAND in true false basename dirname cat tee sleep
+do
+    case $COMMAND in
+        basename) ARGS="/usr/share/doc/file.txt .txt" ;;
+        dirname) ARGS="/usr/share/doc/file.txt" ;;
+        sleep) ARGS="0" ;;
+        *) ARGS="" ;;
+    esac
+
+    ln -s "$POSIXY" "$WORKDIR/$COMMAND"
+
+    # false fails on purpose
+    set +e
+    run posixy "$WORKDIR/$COMMAND" $ARGS
+    for DIR in /usr/bin /bin
+    do
+        if [ -x "$DIR/$COMMAND" ]; then
+            run coreutils "$DIR/$COMMAND" $ARGS
+            break
+        fi
+    done
+    set -e
+done
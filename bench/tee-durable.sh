@@ -0,0 +1,81 @@
+#!/bin/sh
+# Measure the latency of the stdout path of tee while it writes a long
+# stream to disk, with and without the options for O_DIRECT, preallocation,
+# write-behind and rotation
+# Usage: tee-durable.sh path-to-posixy [size-in-MiB] [rate-in-MiB/s]
+#
+# A producer writes 64 KiB records stamped with the time they were sent, at
+# a steady rate, and a consumer on the stdout of tee works out how long each
+# took to come through. Writeback stalls in tee show up in the tail
+# percentiles. The file is written to a temporary directory, so set TMPDIR
+# to measure a particular filesystem. Needs perl for the timestamps.
+
+set -eu
+
+POSIXY="$1"
+SIZE_MB="${2:-2048}"
+RATE_MB="${3:-256}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+produce() {
+    perl -MTime::HiRes=time,sleep -e '
+        my ($records, $rate) = @ARGV;
+        my $pad = "\0" x (65536 - 32);
+        my $start = time;
+        for my $i (0 .. $records - 1) {
+            my $delay = $start + $i / $rate - time;
+            sleep($delay) if $delay > 0;
+            my $record = sprintf("%-32.6f", time) . $pad;
+            while (length $record) {
+                my $n = syswrite(STDOUT, $record) or die "write: $!";
+                substr($record, 0, $n) = "";
+            }
+        }' "$1" "$2"
+}
+
+consume() {
+    perl -MTime::HiRes=time -e '
+        while (1) {
+            my $record = "";
+            while (length $record < 65536) {
+                my $n = sysread(STDIN, $record, 65536 - length $record,
+                                length $record);
+                exit 0 unless $n;
+            }
+            printf "%d\n", (time - substr($record, 0, 32)) * 1e6;
+        }'
+}
+
+RECORDS=$((SIZE_MB * 16))
+RECORD_RATE=$((RATE_MB * 16))
+
+for OPTIONS in none direct prealloc+writebehind direct+prealloc rotate
+do
+    case $OPTIONS in
+    none)                   set -- ;;
+    direct)                 set -- POSIXY_TEE_DIRECT=1 ;;
+    prealloc+writebehind)   set -- POSIXY_TEE_PREALLOC=64M \
+                                   POSIXY_TEE_WRITEBEHIND=8M ;;
+    direct+prealloc)        set -- POSIXY_TEE_DIRECT=1 \
+                                   POSIXY_TEE_PREALLOC=64M ;;
+    rotate)                 set -- POSIXY_TEE_ROTATE=64M ;;
+    esac
+
+    rm -f "$WORKDIR"/output*
+    sync
+    produce $RECORDS $RECORD_RATE |
+        env "$@" "$POSIXY" tee "$WORKDIR/output" |
+        consume | sort -n > "$WORKDIR/latency"
+
+    awk -v options="$OPTIONS" -v bytes=$((SIZE_MB * 1048576)) '
+        { latency[NR] = $1 }
+        function pct(p) { return latency[int((NR - 1) * p) + 1] }
+        END {
+            printf "{\"benchmark\": \"tee-durable\", \"options\": \"%s\", " \
+                   "\"bytes\": %.0f, \"p50_us\": %d, \"p90_us\": %d, " \
+                   "\"p99_us\": %d, \"p999_us\": %d, \"max_us\": %d}\n",
+                   options, bytes, pct(0.5), pct(0.9), pct(0.99),
+                   pct(0.999), latency[NR]
+        }' "$WORKDIR/latency"
+done
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Measure the CPU time taken by tee to copy a stream into several pipes,
+# with read/write and with tee(2) and splice(2)
+# Usage: tee-fanout.sh path-to-posixy [size-in-MiB] [pipes]
+#
+# The CPU time is taken from the times builtin, in a subshell whose only
+# child is tee.
+
+set -eu
+
+POSIXY="$1"
+SIZE_MB="${2:-1024}"
+PIPES="${3:-2}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# Convert the 0m1.234s format of times to milliseconds
+to_ms() {
+    echo "$1" | awk -Fm '{ sub("s", "", $2); printf "%d", ($1 * 60 + $2) * 1000 }'
+}
+
+FIFOS=
+i=0
+while [ $i -lt $PIPES ]
+do
+    mkfifo "$WORKDIR/fifo$i"
+    FIFOS="$FIFOS $WORKDIR/fifo$i"
+    i=$((i + 1))
+done
+
+for METHOD in read/write tee
+do
+    for FIFO in $FIFOS
+    do
+        "$POSIXY" cat "$FIFO" > /dev/null &
+    done
+
+    head -c $((SIZE_MB * 1048576)) /dev/zero | (
+        POSIXY_TEE_METHOD=$METHOD "$POSIXY" tee $FIFOS
+        times > "$WORKDIR/times"
+    ) | "$POSIXY" cat > /dev/null
+    wait
+
+    # The second line has the user and system time of the children
+    set -- $(tail -n 1 "$WORKDIR/times")
+    CPU_MS=$(($(to_ms $1) + $(to_ms $2)))
+
+    echo "{\"benchmark\": \"tee-fanout\", \"method\": \"$METHOD\"," \
+         "\"pipes\": $((PIPES + 1)), \"bytes\": $((SIZE_MB * 1048576))," \
+         "\"user_ms\": $(to_ms $1), \"sys_ms\": $(to_ms $2)," \
+         "\"cpu_ms_per_gb\": $((CPU_MS * 1024 / SIZE_MB))}"
+done
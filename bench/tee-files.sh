@@ -0,0 +1,55 @@
+#!/bin/sh
+# Measure the time taken by tee to copy a stream into many regular files,
+# with read/write and with io_uring
+# Usage: tee-files.sh path-to-posixy [size-in-MiB] [files]
+#
+# The CPU time is taken from the times builtin, in a subshell whose only
+# child is tee. The files are written to a temporary directory, so set
+# TMPDIR to measure a particular filesystem.
+
+set -eu
+
+POSIXY="$1"
+SIZE_MB="${2:-256}"
+FILES="${3:-16}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# Convert the 0m1.234s format of times to milliseconds
+to_ms() {
+    echo "$1" | awk -Fm '{ sub("s", "", $2); printf "%d", ($1 * 60 + $2) * 1000 }'
+}
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+head -c $((SIZE_MB * 1048576)) /dev/urandom > "$WORKDIR/input"
+
+OUTPUTS=
+i=0
+while [ $i -lt $FILES ]
+do
+    OUTPUTS="$OUTPUTS $WORKDIR/out$i"
+    i=$((i + 1))
+done
+
+for METHOD in read/write io_uring
+do
+    rm -f $OUTPUTS
+    START=$(now_ms)
+    (
+        POSIXY_TEE_METHOD=$METHOD "$POSIXY" tee $OUTPUTS \
+            < "$WORKDIR/input" > /dev/null
+        times > "$WORKDIR/times"
+    )
+    END=$(now_ms)
+
+    # The second line has the user and system time of the children
+    set -- $(tail -n 1 "$WORKDIR/times")
+
+    echo "{\"benchmark\": \"tee-files\", \"method\": \"$METHOD\"," \
+         "\"files\": $FILES, \"bytes\": $((SIZE_MB * 1048576))," \
+         "\"wall_ms\": $((END - START)), \"user_ms\": $(to_ms $1)," \
+         "\"sys_ms\": $(to_ms $2)}"
+done
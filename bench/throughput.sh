@@ -0,0 +1,72 @@
+#!/bin/sh
+# Measure the throughput of cat and tee from a file to a pipe, from a file
+# to a file and from a pipe to a pipe, at sizes from 1 KiB up
+# Usage: throughput.sh path-to-posixy [max-size-in-MiB]
+#
+# Each size is multiplied by 32 up to the maximum, and copied as many times
+# as it takes to move 64 MiB, but at least once and at most 100 times, so
+# the small sizes mostly measure starting the processes. The input file
+# is read once first, so that the page cache is warm. The pipes are fed and
+# drained by posixy cat, which is timed along with the command.
+
+set -eu
+
+POSIXY="$1"
+MAX_MB="${2:-1024}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+# Usage: copy command mode
+copy() {
+    case $2 in
+        file-pipe)
+            "$POSIXY" $1 < "$WORKDIR/input" | "$POSIXY" cat > /dev/null ;;
+        file-file)
+            "$POSIXY" $1 < "$WORKDIR/input" > "$WORKDIR/output" ;;
+        pipe-pipe)
+            "$POSIXY" cat "$WORKDIR/input" | "$POSIXY" $1 |
+                "$POSIXY" cat > /dev/null ;;
+    esac
+}
+
+SIZE=1024
+while [ $SIZE -le $((MAX_MB * 1048576)) ]
+do
+    head -c $SIZE /dev/zero > "$WORKDIR/input"
+    "$POSIXY" cat "$WORKDIR/input" > /dev/null
+
+    REPEAT=$((67108864 / SIZE))
+    if [ $REPEAT -lt 1 ]; then
+        REPEAT=1
+    elif [ $REPEAT -gt 100 ]; then
+        REPEAT=100
+    fi
+
+    for COMMAND in cat tee
+    do
+        for MODE in file-pipe file-file pipe-pipe
+        do
+            i=0
+            START=$(now_ns)
+            while [ $i -lt $REPEAT ]
+            do
+                copy $COMMAND $MODE
+                i=$((i + 1))
+            done
+            END=$(now_ns)
+
+            BYTES=$((SIZE * REPEAT))
+            NS=$((END - START))
+            echo "{\"benchmark\": \"throughput\", \"command\": \"$COMMAND\"," \
+                 "\"mode\": \"$MODE\", \"size\": $SIZE," \
+                 "\"repeat\": $REPEAT, \"us_per_copy\": $((NS / 1000 / REPEAT))," \
+                 "\"mib_per_s\": $((BYTES * 1000 / 1048576 * 1000000 / NS))}"
+        done
+    done
+
+    SIZE=$((SIZE * 32))
+done
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Measure the cost of POSIXY_TRACE on short-lived commands, and report where
+# their time goes
+# Usage: trace.sh path-to-posixy [count]
+
+set -eu
+
+POSIXY="$1"
+COUNT="${2:-2000}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+run() {
+    i=0
+    while [ $i -lt $COUNT ]
+    do
+        "$POSIXY" basename /usr/share/doc/file$i.txt .txt
+        "$POSIXY" true
+        i=$((i + 1))
+    done > /dev/null
+}
+
+START=$(now_ns)
+run
+END=$(now_ns)
+PLAIN_NS=$((END - START))
+
+START=$(now_ns)
+POSIXY_TRACE="$WORKDIR/trace" run
+END=$(now_ns)
+TRACE_NS=$((END - START))
+
+COMMANDS=$((COUNT * 2))
+echo "{\"benchmark\": \"trace\", \"commands\": $COMMANDS," \
+     "\"plain_ns_per_command\": $((PLAIN_NS / COMMANDS))," \
+     "\"trace_ns_per_command\": $((TRACE_NS / COMMANDS))," \
+     "\"trace_bytes\": $(wc -c < "$WORKDIR/trace")}"
+
+"$POSIXY" trace-report "$WORKDIR/trace" >&2
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Measure the throughput of wc -l and wc over a large file in the page
+# cache, with one thread and with the default, against coreutils wc
+# Usage: wc.sh path-to-posixy [size-in-MiB]
+#
+# The file is made of short lines of words, like a log. Each run is the
+# best of three, and coreutils wc runs in the C locale, as posixy does.
+
+set -eu
+
+POSIXY="$1"
+SIZE_MB="${2:-1024}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+    date +%s%N
+}
+
+i=0
+while [ $i -lt 1000 ]
+do
+    echo "2024-01-01T00:00:$i host service[$i]: request handled in $i ms"
+    i=$((i + 1))
+done > "$WORKDIR/lines"
+
+while [ $(wc -c < "$WORKDIR/lines") -lt $((SIZE_MB * 1048576)) ]
+do
+    cat "$WORKDIR/lines" "$WORKDIR/lines" > "$WORKDIR/more"
+    mv "$WORKDIR/more" "$WORKDIR/lines"
+done
+head -c $((SIZE_MB * 1048576)) "$WORKDIR/lines" > "$WORKDIR/log"
+rm "$WORKDIR/lines"
+cat "$WORKDIR/log" > /dev/null
+
+# Usage: run implementation threads options
+run() {
+    BEST=
+    for TRY in 1 2 3
+    do
+        START=$(now_ns)
+        if [ $1 = posixy ]; then
+            POSIXY_WC_THREADS=$2 "$POSIXY" wc $3 "$WORKDIR/log" > /dev/null
+        else
+            LC_ALL=C wc $3 "$WORKDIR/log" > /dev/null
+        fi
+        NS=$(($(now_ns) - START))
+        if [ -z "$BEST" ] || [ $NS -lt $BEST ]; then
+            BEST=$NS
+        fi
+    done
+
+    echo "{\"benchmark\": \"wc\", \"implementation\": \"$1\"," \
+         "\"threads\": $2, \"options\": \"$3\", \"bytes\": $((SIZE_MB * 1048576))," \
+         "\"ms\": $((BEST / 1000000))," \
+         "\"mib_per_s\": $((SIZE_MB * 1000000 / (BEST / 1000)))}"
+}
+
+for OPTIONS in -l -lwc
+do
+    run posixy 1 $OPTIONS
+    run posixy "$(getconf _NPROCESSORS_ONLN)" $OPTIONS
+    run coreutils 1 $OPTIONS
+done
@@ -0,0 +1,234 @@
+/*
+ * Batch mode for posixy
+ *
+ *     posixy --batch [-0] [-s status-file] [file]
+ *
+ * Read commands from file, or from standard input if no file is given, and
+ * run each of them through the dispatcher in this process. By default each
+ * line is a command, with arguments separated by blanks. With -0, arguments
+ * are terminated by NUL characters, and each command is terminated by an
+ * empty argument.
+ *
+ * If -s is given, the exit status of each command is written to the status
+ * file, one per line. The exit status of posixy is zero only if all commands
+ * succeeded.
+ *
+ * When the commands are read from standard input, the handlers see
+ * /dev/null as their standard input.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "posixy.h"
+
+#define PROGRAM     PROGNAME " --batch"
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s [-0] [-s status-file] [file]\n", PROGRAM);
+}
+
+/* Append an argument to the vector, growing it as required */
+static int push_arg(char ***args, size_t *count, size_t *alloc, char *arg)
+{
+    char **new_args;
+
+    if (*count + 1 >= *alloc) {
+        *alloc = *alloc ? *alloc * 2 : 16;
+        new_args = realloc(*args, *alloc * sizeof(char *));
+        if (new_args == NULL) {
+            return -1;
+        }
+        *args = new_args;
+    }
+
+    (*args)[(*count)++] = arg;
+    (*args)[*count] = NULL;
+    return 0;
+}
+
+/*
+ * Read the next command into args, which points into storage owned by line.
+ * Returns the number of arguments, or -1 at the end of the input.
+ */
+static int read_command(FILE *input, int nul_delimited, char **line,
+                        size_t *line_size, char ***args, size_t *alloc)
+{
+    size_t count = 0;
+    size_t used = 0;
+    size_t i;
+    ssize_t len;
+    char *token;
+    char *saveptr;
+
+    if (!nul_delimited) {
+        do {
+            len = getline(line, line_size, input);
+            if (len == -1) {
+                return -1;
+            }
+
+            count = 0;
+            for (token = strtok_r(*line, " \t\n", &saveptr); token;
+                 token = strtok_r(NULL, " \t\n", &saveptr)) {
+                if (push_arg(args, &count, alloc, token) == -1) {
+                    return -1;
+                }
+            }
+        } while (count == 0);
+
+        return count;
+    }
+
+    /*
+     * Collect the NUL terminated arguments into the line buffer, and only
+     * build the vector at the end, since the buffer may be reallocated.
+     */
+    for (;;) {
+        int c = getc(input);
+
+        if (c == EOF) {
+            if (used == 0) {
+                return -1;
+            }
+            /* Terminate a final argument that has no trailing NUL */
+            if ((*line)[used - 1] == '\0') {
+                break;
+            }
+            c = '\0';
+        }
+
+        if (c == '\0' && (used == 0 || (*line)[used - 1] == '\0')) {
+            /* An empty argument ends the command, skip empty commands */
+            if (used == 0) continue;
+            break;
+        }
+
+        if (used + 1 > *line_size) {
+            char *new_line = realloc(*line, *line_size ? *line_size * 2 : 256);
+
+            if (new_line == NULL) {
+                return -1;
+            }
+            *line = new_line;
+            *line_size = *line_size ? *line_size * 2 : 256;
+        }
+
+        (*line)[used++] = c;
+    }
+
+    for (i = 0; i < used; i += strlen(*line + i) + 1) {
+        if (push_arg(args, &count, alloc, *line + i) == -1) {
+            return -1;
+        }
+    }
+
+    return count;
+}
+
+int posixy_batch(int argc, char **argv)
+{
+    int opt;
+    int nul_delimited = 0;
+    int retval = 0;
+    int status;
+    int count;
+    int fd;
+    char *status_file = NULL;
+    FILE *input;
+    FILE *status_output = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    char **args = NULL;
+    size_t alloc = 0;
+
+    while ((opt = getopt(argc, argv, "0s:")) != -1) {
+        switch (opt) {
+        case '0':
+            nul_delimited = 1;
+            break;
+        case 's':
+            status_file = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind > 1) {
+        usage();
+        return 1;
+    }
+
+    if (optind < argc && strcmp(argv[optind], "-") != 0) {
+        input = fopen(argv[optind], "re");
+        if (input == NULL) {
+            fprintf(stderr, "%s: %s: %s\n", PROGRAM, argv[optind],
+                    strerror(errno));
+            return 1;
+        }
+    } else {
+        /* Move the commands off stdin, so the handlers can't consume them */
+        fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+        input = (fd == -1) ? NULL : fdopen(fd, "r");
+        if (input == NULL) {
+            fprintf(stderr, "%s: stdin: %s\n", PROGRAM, strerror(errno));
+            return 1;
+        }
+
+        fd = open("/dev/null", O_RDONLY);
+        if (fd != -1) {
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+        }
+    }
+
+    if (status_file) {
+        status_output = fopen(status_file, "we");
+        if (status_output == NULL) {
+            fprintf(stderr, "%s: %s: %s\n", PROGRAM, status_file,
+                    strerror(errno));
+            fclose(input);
+            return 1;
+        }
+    }
+
+    while ((count = read_command(input, nul_delimited, &line, &line_size,
+                                 &args, &alloc)) != -1) {
+        posixy_reset();
+        status = posixy_dispatch(count, args);
+
+        /* Keep the output of stdio and write(2) based handlers in order */
+        fflush(stdout);
+
+        if (status != 0) {
+            retval = 1;
+        }
+
+        if (status_output) {
+            fprintf(status_output, "%d\n", status);
+        }
+    }
+
+    if (ferror(input)) {
+        fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+        retval = 1;
+    }
+
+    if (status_output && fclose(status_output) == EOF) {
+        fprintf(stderr, "%s: %s: %s\n", PROGRAM, status_file, strerror(errno));
+        retval = 1;
+    }
+
+    fclose(input);
+    free(line);
+    free(args);
+
+    return retval;
+}
@@ -42,6 +42,21 @@ OPTIONS
 
     None.
 
+    As an extension, if no string operand is given, each line of the
+    standard input is taken as a string, and the result for it written as a
+    line to the standard output. The following options apply to this mode:
+
+    -s suffix
+        Remove the suffix, as for the suffix operand.
+    -z
+        Strings are terminated by NUL characters rather than newlines, both
+        on the standard input and on the standard output.
+
+    The options are only recognized when they are the only arguments.
+    Otherwise all of the arguments are operands, even those that begin
+    with '-', as POSIX defines no options. A first argument of "--" is
+    skipped.
+
 OPERANDS
 
     The following operands shall be supported:
@@ -53,7 +68,7 @@ OPERANDS
 
 STDIN
 
-    Not used.
+    Not used, except as an extension. See OPTIONS.
 
 INPUT FILES
 
@@ -124,75 +139,107 @@ CONSEQUENCES OF ERRORS
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-int posix_basename(int argc, char **argv)
+#include "pathname.h"
+#include "records.h"
+
+#define PROGRAM     "basename"
+
+struct suffix {
+    const char *string;
+    size_t len;
+};
+
+/*
+ * Steps 1 to 6 on a string of len bytes, which need not be terminated.
+ * Returns the result, which points into the string, and sets *result_len.
+ */
+static const char *basename_of(const char *string, size_t len,
+                               size_t *result_len, void *arg)
 {
-    int i;
-    int only_slashes;
-    char *string_ptr;
-    char *out_ptr;
-    size_t string_len;
-    size_t suffix_len;
-    size_t suffix_pos = 0;
-
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: basename string [suffix]\n");
-        return 1;
+    const struct suffix *suffix = arg;
+    struct pathname split;
+    size_t end;
+
+    /* Steps 1 to 5, the null string and a string of slashes are left as is */
+    pathname_split(string, len, &split);
+    if (split.base_end == 0) {
+        *result_len = len ? 1 : 0;
+        return string;
     }
 
-    /* At least 2 arguments, check if the string consists of only slashes */
-    for (string_ptr = argv[1], only_slashes = 1; *string_ptr; string_ptr++) {
-        if (*string_ptr != '/') {
-            only_slashes = 0;
-            break;
-        }
+    /* Step 6 */
+    end = split.base_end;
+    if (suffix && suffix->len > 0 && end - split.base_start > suffix->len &&
+        memcmp(string + end - suffix->len, suffix->string, suffix->len) == 0) {
+        end -= suffix->len;
     }
 
-    if (only_slashes) {
-        /* Step 3 - if only slashes, print the last slash and exit */
-        /* Go back one step, and print the string */
-        string_ptr--;
-        printf("%s\n", string_ptr);
-        return 0;
-    }
+    *result_len = end - split.base_start;
+    return string + split.base_start;
+}
 
-    /* Step 4, remove any trailing slashes */
-    string_len = strlen(argv[1]);
-    string_ptr = strdup(argv[1]);
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s string [suffix]\n"
+                    "       %s [-z] [-s suffix] < strings\n",
+            PROGRAM, PROGRAM);
+}
+
+int posix_basename(int argc, char **argv)
+{
+    struct suffix suffix = { NULL, 0 };
+    const char *result;
+    size_t result_len;
+    int delimiter = '\n';
+    int streaming = 1;
+    int first;
+    int opt;
+
+    /*
+     * Options stop at the first operand, and only count if nothing else
+     * follows them, so that a string such as -x or a-b -b is an operand
+     */
+    opterr = 0;
+    while (streaming && (opt = getopt(argc, argv, "+s:z")) != -1) {
+        switch (opt) {
+        case 's':
+            suffix.string = optarg;
+            suffix.len = strlen(optarg);
+            break;
 
-    for (i = string_len - 1; i >= 0; i++) {
-        if (string_ptr[i] == '/') {
-            string_ptr[i] = '\0';
-            string_len--;
-        } else {
+        case 'z':
+            delimiter = '\0';
+            break;
+
+        default:
+            streaming = 0;
             break;
         }
     }
 
-    /* Step 5, remove up to last / */
-    out_ptr = strrchr(string_ptr, '/');
-    if (out_ptr == NULL) {
-        out_ptr = string_ptr;
-    } else {
-        out_ptr++;
+    /* With no string, map each line or NUL terminated string on stdin */
+    if (streaming && optind == argc) {
+        return records_map(STDIN_FILENO, STDOUT_FILENO, delimiter,
+                           basename_of, &suffix, PROGRAM);
     }
-    string_len = strlen(out_ptr);
-
-    /* Step 6, remove a trailing suffix, if it exists */
-    if (argc == 3) {
-        suffix_len = strlen(argv[2]);
-
-        if (string_len > suffix_len) {
-            suffix_pos = string_len - suffix_len;
-            if (strcmp(&out_ptr[suffix_pos], argv[2]) == 0) {
-                /* Suffix matches, get rid of it */
-                out_ptr[suffix_pos] = 0;
-            }
-        }
+
+    first = (argc > 1 && strcmp(argv[1], "--") == 0) ? 2 : 1;
+    if (argc - first < 1 || argc - first > 2) {
+        usage();
+        return 1;
     }
 
-    printf("%s\n", out_ptr);
+    suffix.string = NULL;
+    suffix.len = 0;
+    if (argc - first == 2) {
+        suffix.string = argv[first + 1];
+        suffix.len = strlen(suffix.string);
+    }
 
-    free(string_ptr);
+    result = basename_of(argv[first], strlen(argv[first]), &result_len,
+                         &suffix);
+    printf("%.*s\n", (int)result_len, result);
     return 0;
 }
@@ -102,6 +102,7 @@ CONSEQUENCES OF ERRORS
 
  **********************************************************************
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -111,41 +112,490 @@ CONSEQUENCES OF ERRORS
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#include "iobuf.h"
+#include "stats.h"
+#include "uring.h"
 
 #define PROGRAM     "cat"
 
+/* Maximum number of bytes moved by a single zero-copy system call */
+#define ZERO_COPY_CHUNK     (1 << 30)
+
+/* Size of the window of the input file mapped at a time by the mmap method */
+#define MMAP_WINDOW         (8 * 1024 * 1024)
+
+/* Regular files up to this size are read whole, and written out in batches */
+#define SMALL_FILE          (64 * 1024)
+
+/* Number of chunks kept in flight by the io_uring engine, and their size */
+#define URING_DEPTH         8
+#define URING_CHUNK         (256 * 1024)
+
 /*
- * Single page of memory that is used to read from FILE/stdin and write to
- * stdout. However, this is unused if cat is unbuffered.
+ * Number of threads opening upcoming operands, how many operands they may
+ * run ahead of the one being copied, and how much of each file to read ahead
  */
-char *buffer_page;
+#define PREFETCH_THREADS    4
+#define PREFETCH_WINDOW     16
+#define PREFETCH_BYTES      (1024 * 1024)
+#define PREFETCH_STACK      (64 * 1024)
 
-/* Size of the buffer page */
-size_t buffer_size;
+/*
+ * Fewest operands for the prefetch threads to start by default. Below this,
+ * or with a single CPU, creating and joining the threads costs more than
+ * opening the files in line saves, even with a cold cache.
+ */
+#define PREFETCH_MIN_FILES  64
+
+/* Ways of copying a file to stdout, in the kernel where possible */
+enum copy_method {
+    COPY_READ_WRITE,
+    COPY_FILE_RANGE,
+    COPY_SENDFILE,
+    COPY_SPLICE,
+    COPY_MMAP,
+    COPY_URING,
+    COPY_METHODS
+};
+
+static const char *copy_method_names[] = {
+    [COPY_READ_WRITE] = "read/write",
+    [COPY_FILE_RANGE] = "copy_file_range",
+    [COPY_SENDFILE] = "sendfile",
+    [COPY_SPLICE] = "splice",
+    [COPY_MMAP] = "mmap",
+    [COPY_URING] = "io_uring",
+};
+
+/*
+ * Buffer that is used to read from FILE/stdin and write to stdout. This is
+ * only allocated when a file can't be copied by the kernel, and is sized by
+ * the policy in iobuf.c.
+ */
+struct iobuf buffer_page;
 
 /* Flag to indicate if I/O should be unbuffered */
 int unbuffered;
 
+/* Flag to report the copy method used for each file, set by POSIXY_DEBUG */
+static int debug;
+
+/* File type of stdout, used to select the copy method */
+static mode_t stdout_mode;
+
+/* Copy method requested with POSIXY_CAT_METHOD, COPY_METHODS if automatic */
+static enum copy_method forced_method;
+
+/*
+ * Contents of small files that have been read but not yet written. Many
+ * small files are written with one write call, rather than one each. This
+ * is disabled by -u, or by setting POSIXY_CAT_COALESCE to 0.
+ *
+ * Each file is read straight into the free end of the buffer, so nothing
+ * is copied to make it contiguous. A writev over a buffer per file would
+ * cost an allocation per file and be limited to IOV_MAX files per call,
+ * where one buffer takes as many files as fit in the buffer ceiling.
+ */
+static struct iobuf batch;
+static size_t batch_used;
+static int coalesce;
+
+/* Counters for POSIXY_STATS, NULL unless enabled. Inputs are counted as one. */
+static struct stats_stream *input_stats;
+static struct stats_stream *stdout_stats;
+
 static void usage(void)
 {
     fprintf(stderr, "Usage: %s [-u] [file...]\n", PROGRAM);
 }
 
-static int cat_file(char *filename)
+/* Check if a copy method can be used for the given input file type */
+static int copy_method_usable(enum copy_method method, mode_t mode)
+{
+    switch (method) {
+    case COPY_READ_WRITE:
+        return 1;
+    case COPY_MMAP:
+        return S_ISREG(mode);
+#ifdef HAVE_COPY_FILE_RANGE
+    case COPY_FILE_RANGE:
+        return S_ISREG(mode) && S_ISREG(stdout_mode);
+#endif
+#ifdef HAVE_SENDFILE
+    case COPY_SENDFILE:
+        return S_ISREG(mode);
+#endif
+#ifdef HAVE_SPLICE
+    case COPY_SPLICE:
+        return S_ISFIFO(mode) || S_ISFIFO(stdout_mode);
+#endif
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Select the fastest way to copy from a file to stdout, based on the file
+ * types. splice requires one end to be a pipe, sendfile requires a regular
+ * (mmap-able) input, and copy_file_range requires both ends to be regular
+ * files. A method requested with POSIXY_CAT_METHOD takes precedence, as
+ * long as it can be used for this file.
+ */
+static enum copy_method select_copy_method(const struct stat *st)
+{
+    if (forced_method != COPY_METHODS &&
+        copy_method_usable(forced_method, st->st_mode)) {
+        return forced_method;
+    }
+
+    if (S_ISFIFO(st->st_mode) && copy_method_usable(COPY_SPLICE, st->st_mode)) {
+        return COPY_SPLICE;
+    }
+
+    if (S_ISREG(st->st_mode)) {
+        if (S_ISREG(stdout_mode) &&
+            copy_method_usable(COPY_FILE_RANGE, st->st_mode)) {
+            return COPY_FILE_RANGE;
+        }
+
+        if ((S_ISFIFO(stdout_mode) || S_ISSOCK(stdout_mode)) &&
+            copy_method_usable(COPY_SENDFILE, st->st_mode)) {
+            return COPY_SENDFILE;
+        }
+    }
+
+    return COPY_READ_WRITE;
+}
+
+/*
+ * Copy fd to stdout without passing the data through userspace. Returns 0
+ * once the end of the file is reached, or -1 if the rest of the file should
+ * be copied with read/write instead.
+ *
+ * Any error causes a fallback rather than being reported here. Errors such
+ * as EINVAL, EXDEV or ENOSYS only mean that the kernel can't do this copy,
+ * and genuine I/O errors will recur in the read/write loop, which reports
+ * them against the right file. The file offsets are updated by each call,
+ * so the fallback continues where this left off.
+ */
+static int cat_zero_copy(int fd, char *filename, enum copy_method method)
+{
+    ssize_t bytes_copied;
+    unsigned long long start;
+    int copied_any = 0;
+
+    for (;;) {
+        start = stats_begin(stdout_stats);
+        switch (method) {
+#ifdef HAVE_COPY_FILE_RANGE
+        case COPY_FILE_RANGE:
+            bytes_copied = copy_file_range(fd, NULL, STDOUT_FILENO, NULL,
+                                           ZERO_COPY_CHUNK, 0);
+            break;
+#endif
+#ifdef HAVE_SENDFILE
+        case COPY_SENDFILE:
+            bytes_copied = sendfile(STDOUT_FILENO, fd, NULL, ZERO_COPY_CHUNK);
+            break;
+#endif
+#ifdef HAVE_SPLICE
+        case COPY_SPLICE:
+            bytes_copied = splice(fd, NULL, STDOUT_FILENO, NULL,
+                                  ZERO_COPY_CHUNK, SPLICE_F_MOVE);
+            break;
+#endif
+        default:
+            return -1;
+        }
+
+        if (stdout_stats) {
+            stats_copy_done(input_stats, stdout_stats, start, bytes_copied);
+        }
+
+        if (bytes_copied == -1) {
+            if (errno == EINTR) continue;
+
+            if (debug) {
+                fprintf(stderr, "%s: %s: %s failed, using %s: %s\n", PROGRAM,
+                        filename, copy_method_names[method],
+                        copy_method_names[COPY_READ_WRITE], strerror(errno));
+            }
+            return -1;
+        }
+
+        if (bytes_copied == 0) {
+            /*
+             * Some files (for example in /proc) report EOF to the zero-copy
+             * calls without any data, so let read/write confirm that an
+             * apparently empty file is really empty.
+             */
+            return copied_any ? 0 : -1;
+        }
+
+        copied_any = 1;
+    }
+}
+
+/* Write all of buf to stdout, returns -1 on error */
+static int write_all(const char *buf, size_t len)
+{
+    ssize_t bytes_written;
+
+    while (len > 0) {
+        bytes_written = stats_write(stdout_stats, STDOUT_FILENO, buf, len);
+        if (bytes_written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        buf += bytes_written;
+        len -= bytes_written;
+    }
+
+    return 0;
+}
+
+/* Write out the batched small files, returns 1 if the write failed */
+static int batch_flush(void)
+{
+    int retval = 0;
+
+    if (batch_used > 0 && write_all(batch.data, batch_used) == -1) {
+        fprintf(stderr, "%s: stdout: %s\n", PROGRAM, strerror(errno));
+        retval = 1;
+    }
+
+    batch_used = 0;
+    return retval;
+}
+
+/*
+ * Read a small regular file into the batch, flushing the batch first if
+ * there is no room. Returns 0 once the whole file is in the batch, 1 if
+ * writing to stdout failed, or -1 if the rest of the file should be copied
+ * the usual way. Anything read up to that point stays in the batch.
+ *
+ * One more byte than the size of the file is asked for, so that a read of
+ * exactly the size means the end of the file without a second read. Files
+ * in /sys and the like report a size that doesn't match their contents,
+ * and are left to the read/write loop.
+ */
+static int cat_small(int fd, char *filename, const struct stat *st)
+{
+    size_t want = st->st_size + 1;
+    ssize_t bytes_read;
+
+    if (batch.data == NULL && iobuf_reserve(&batch, iobuf_max()) == -1) {
+        return -1;
+    }
+
+    if (want > batch.size) {
+        return -1;
+    }
+
+    if (batch_used + want > batch.size && batch_flush()) {
+        return 1;
+    }
+
+    do {
+        bytes_read = stats_read(input_stats, fd, batch.data + batch_used, want);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read == -1) {
+        return -1;
+    }
+
+    batch_used += bytes_read;
+    if (bytes_read != st->st_size) {
+        return -1;
+    }
+
+    if (debug) {
+        fprintf(stderr, "%s: %s: batched\n", PROGRAM, filename);
+    }
+
+    return 0;
+}
+
+/*
+ * Record which pages of the file from start onwards are in the page cache,
+ * one bit per page. This is done by mapping the file without touching it,
+ * and asking mincore. Returns NULL if the residency can't be determined.
+ */
+static unsigned char *cache_snapshot(int fd, off_t start, off_t size,
+                                     size_t page)
+{
+    static unsigned char vec[MMAP_WINDOW / 4096];
+    unsigned char *bitmap;
+    size_t pages = (size - start + page - 1) / page;
+    size_t window_pages;
+    size_t base = 0;
+    size_t len;
+    size_t i;
+    char *data;
+
+    if (MMAP_WINDOW / page > sizeof(vec)) {
+        return NULL;
+    }
+
+    bitmap = calloc((pages + 7) / 8, 1);
+    if (bitmap == NULL) {
+        return NULL;
+    }
+
+    while (base < pages) {
+        len = size - (start + base * page);
+        if (len > MMAP_WINDOW) {
+            len = MMAP_WINDOW;
+        }
+        window_pages = (len + page - 1) / page;
+
+        data = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, start + base * page);
+        if (data == MAP_FAILED) {
+            free(bitmap);
+            return NULL;
+        }
+
+        if (mincore(data, len, vec) == -1) {
+            munmap(data, len);
+            free(bitmap);
+            return NULL;
+        }
+        munmap(data, len);
+
+        for (i = 0; i < window_pages; i++) {
+            if (vec[i] & 1) {
+                bitmap[(base + i) / 8] |= 1 << ((base + i) % 8);
+            }
+        }
+
+        base += window_pages;
+    }
+
+    return bitmap;
+}
+
+/*
+ * Copy a regular file to stdout by mapping it in windows of MMAP_WINDOW
+ * bytes and writing straight from the mapping, while the next window is
+ * read ahead.
+ *
+ * Once a window has been written, the pages that were not in the page cache
+ * when the copy started are dropped again, so that copying a large file does
+ * not evict everything else from the cache. Pages that were already cached
+ * are left alone. The residency is recorded for the whole file up front,
+ * since the kernel's own read ahead can run more than a window ahead.
+ *
+ * The file offset is left after the data that was written, and the
+ * read/write loop then copies whatever is left. That covers data appended
+ * since the file was mapped, and as with the zero-copy methods, errors are
+ * left for the read/write loop to report.
+ */
+static void cat_mmap(int fd, char *filename, const struct stat *st)
+{
+    size_t page = sysconf(_SC_PAGE_SIZE);
+    unsigned char *cached;
+    off_t offset;
+    off_t start;
+    off_t map_start;
+    size_t len;
+    size_t i;
+    size_t run;
+    size_t done;
+    char *data;
+
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == -1 || offset >= st->st_size) {
+        return;
+    }
+
+    start = offset - offset % page;
+    cached = cache_snapshot(fd, start, st->st_size, page);
+
+    while (offset < st->st_size) {
+        map_start = offset - offset % page;
+        len = st->st_size - map_start;
+        if (len > MMAP_WINDOW) {
+            len = MMAP_WINDOW;
+        }
+
+        data = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, map_start);
+        if (data == MAP_FAILED) {
+            break;
+        }
+
+        madvise(data, len, MADV_SEQUENTIAL);
+
+        /* Start reading the next window while this one is written */
+        posix_fadvise(fd, map_start + len, MMAP_WINDOW, POSIX_FADV_WILLNEED);
+
+        if (write_all(data + (offset - map_start),
+                      len - (offset - map_start)) == -1) {
+            munmap(data, len);
+            break;
+        }
+
+        if (input_stats) {
+            stats_copy_done(input_stats, NULL, 0, len - (offset - map_start));
+        }
+
+        munmap(data, len);
+        offset = map_start + len;
+
+        /* Drop the pages behind the cursor that this copy brought in */
+        done = (size_t)(offset - start);
+        for (i = (map_start - start) / page; cached && i * page < done;
+             i += run) {
+            for (run = 0; (i + run) * page < done &&
+                 !(cached[(i + run) / 8] & (1 << ((i + run) % 8))); run++);
+
+            if (run > 0) {
+                posix_fadvise(fd, start + i * page, run * page,
+                              POSIX_FADV_DONTNEED);
+            } else {
+                run = 1;
+            }
+        }
+    }
+
+    if (offset < st->st_size && debug) {
+        fprintf(stderr, "%s: %s: %s failed, using %s: %s\n", PROGRAM,
+                filename, copy_method_names[COPY_MMAP],
+                copy_method_names[COPY_READ_WRITE], strerror(errno));
+    }
+
+    free(cached);
+    lseek(fd, offset, SEEK_SET);
+}
+
+/*
+ * Copy a file to stdout. If fd is not -1, it is the file already opened by
+ * the prefetch threads, and it is closed once the file has been copied.
+ */
+static int cat_file(char *filename, int fd)
 {
-    int fd = -1;
     int close_fd = 0;
-    int bytes_read;
-    int bytes_written;
+    ssize_t bytes_read;
     int retval = 0;
+    enum copy_method method = COPY_READ_WRITE;
+    struct stat st;
 
-    if (strcmp(filename, "-") == 0) {
+    if (fd != -1) {
+        close_fd = 1;
+    } else if (strcmp(filename, "-") == 0) {
         /* Output stdin */
         fd = STDIN_FILENO;
     } else {
         fd = open(filename, O_RDONLY);
         
         if (fd == -1) {
+            batch_flush();
             fprintf(stderr, "%s: %s: %s\n", PROGRAM, filename, strerror(errno));
             return 1;
         }
@@ -153,8 +603,52 @@ static int cat_file(char *filename)
         close_fd = 1;
     }
 
+    if (fstat(fd, &st) == 0) {
+        if (coalesce && S_ISREG(st.st_mode) && st.st_size > 0 &&
+            st.st_size <= SMALL_FILE) {
+            retval = cat_small(fd, filename, &st);
+            if (retval != -1) {
+                goto out;
+            }
+            retval = 0;
+        }
+
+        method = select_copy_method(&st);
+
+        /* Files are read from start to end, so tell the kernel */
+        if (S_ISREG(st.st_mode)) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+
+    /* Anything batched so far goes out before this file */
+    if (batch_flush()) {
+        retval = 1;
+        goto out;
+    }
+
+    if (debug) {
+        fprintf(stderr, "%s: %s: using %s\n", PROGRAM, filename,
+                copy_method_names[method]);
+    }
+
+    if (method == COPY_MMAP) {
+        cat_mmap(fd, filename, &st);
+    } else if (method != COPY_READ_WRITE &&
+               cat_zero_copy(fd, filename, method) == 0) {
+        goto out;
+    }
+
+    if (iobuf_reserve(&buffer_page, iobuf_size_hint(fd, STDOUT_FILENO)) == -1 &&
+        buffer_page.data == NULL) {
+        fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+        retval = 1;
+        goto out;
+    }
+
     for (;;) {
-        bytes_read = read(fd, buffer_page, buffer_size);
+        bytes_read = stats_read(input_stats, fd, buffer_page.data,
+                                buffer_page.size);
         if (bytes_read == 0) break;
         if (bytes_read == -1) {
             /* If the read failed because it was interrupted by a signal,
@@ -166,29 +660,695 @@ static int cat_file(char *filename)
             break;
         }
 
-        bytes_written = write(STDOUT_FILENO, buffer_page, bytes_read);
-        if (bytes_written == -1) {
+        if (write_all(buffer_page.data, bytes_read) == -1) {
             fprintf(stderr, "%s: stdout: %s\n", PROGRAM, strerror(errno));
             retval = 1;
             break;
         }
+
+        /* A full buffer means that there is more to come, read bigger chunks */
+        if ((size_t)bytes_read == buffer_page.size) {
+            iobuf_grow(&buffer_page);
+        }
     }
 
+out:
     if (close_fd)
         close(fd);
 
     return retval; 
 }
 
+#ifdef HAVE_IO_URING
+/* Tag for write completions, the rest of user_data is the chunk sequence */
+#define URING_WRITE         (1ULL << 63)
+
+/*
+ * Size of each chunk, at most URING_CHUNK. The buffers for all the chunks
+ * are taken from one iobuf, so this is reduced to fit in POSIXY_IOBUF_MAX.
+ */
+static size_t uring_chunk_size;
+
+/* State of an input operand for the io_uring engine */
+struct uring_input {
+    char *name;
+    int fd;
+    int opened;
+    int barrier;            /* Not a regular file, copied by cat_file */
+    int eof;                /* A read found the end of the file */
+    int error;              /* errno of the first failed open or read */
+    off_t error_offset;     /* Chunks from here on are not written */
+    off_t size;
+    off_t next;             /* Offset of the next chunk to read */
+    unsigned int pending;   /* Chunks queued but not yet written */
+};
+
+/* A chunk of an input, read into its buffer and then written to stdout */
+struct uring_chunk {
+    size_t input;
+    char *buf;
+    off_t offset;
+    size_t filled;
+    size_t written;
+    int ready;
+    unsigned long long started;     /* When the write was queued, for stats */
+};
+
+/*
+ * Open an input ahead of time. Only regular files are opened here, anything
+ * else (including stdin and files that can't be opened) is a barrier, which
+ * is copied by cat_file once all the preceding data has been written. That
+ * keeps FIFOs and devices from being opened out of sequence, and leaves the
+ * error messages to cat_file.
+ */
+static void uring_open(struct uring_input *in)
+{
+    struct stat st;
+
+    in->opened = 1;
+    if (strcmp(in->name, "-") == 0 || stat(in->name, &st) == -1 ||
+        !S_ISREG(st.st_mode)) {
+        in->barrier = 1;
+        return;
+    }
+
+    in->fd = open(in->name, O_RDONLY | O_CLOEXEC);
+    if (in->fd == -1) {
+        in->error = errno;
+        return;
+    }
+
+    in->size = st.st_size;
+
+    if (debug) {
+        fprintf(stderr, "%s: %s: using %s\n", PROGRAM, in->name,
+                copy_method_names[COPY_URING]);
+    }
+}
+
+static void uring_queue_read(struct uring *ring, struct uring_chunk *chunk,
+                             struct uring_input *in, unsigned long long seq)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    uring_prep_rw(sqe, IORING_OP_READ, in->fd, chunk->buf + chunk->filled,
+                  uring_chunk_size - chunk->filled,
+                  chunk->offset + chunk->filled);
+    sqe->user_data = seq;
+}
+
+static void uring_queue_write(struct uring *ring, struct uring_chunk *chunk,
+                              unsigned long long seq)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    /* An offset of -1 writes at the current position, as write(2) does */
+    uring_prep_rw(sqe, IORING_OP_WRITE, STDOUT_FILENO,
+                  chunk->buf + chunk->written, chunk->filled - chunk->written,
+                  -1);
+    sqe->user_data = seq | URING_WRITE;
+    chunk->started = stats_begin(stdout_stats);
+}
+
+/*
+ * Complete an input once all of its chunks have been written. If the last
+ * read filled its chunk, the file may have grown since it was opened, so
+ * copy the rest synchronously. Returns 1 if the input failed, or -1 if
+ * writing to stdout failed.
+ */
+static int uring_finish(struct uring_input *in, char *buf)
+{
+    off_t offset = in->next;
+    ssize_t bytes_read;
+    int retval = 0;
+
+    while (!in->error && !in->eof) {
+        bytes_read = pread(in->fd, buf, uring_chunk_size, offset);
+        if (input_stats) {
+            stats_read_done(input_stats, bytes_read);
+        }
+        if (bytes_read == 0) break;
+        if (bytes_read == -1) {
+            if (errno == EINTR) continue;
+            in->error = errno;
+            break;
+        }
+
+        if (write_all(buf, bytes_read) == -1) {
+            fprintf(stderr, "%s: stdout: %s\n", PROGRAM, strerror(errno));
+            retval = -1;
+            break;
+        }
+        offset += bytes_read;
+    }
+
+    if (in->error) {
+        fprintf(stderr, "%s: %s: %s\n", PROGRAM, in->name, strerror(in->error));
+        if (retval == 0) {
+            retval = 1;
+        }
+    }
+
+    if (in->fd != -1) {
+        close(in->fd);
+        in->fd = -1;
+    }
+
+    return retval;
+}
+
+/*
+ * Copy all the operands to stdout with io_uring. Up to URING_DEPTH chunks
+ * are read at a time, running ahead into the following files, so that the
+ * head of the next file is read while the tail of this one is written. The
+ * writes go out one at a time in operand order, as soon as the chunk has
+ * been read and the previous write has completed.
+ *
+ * Returns -1 with nothing written if io_uring can't be used, so that the
+ * caller can use cat_file instead.
+ */
+static int cat_uring(char **files, size_t count)
+{
+    struct uring ring;
+    struct iobuf buffers = {NULL, 0, 0};
+    struct uring_input *inputs;
+    struct uring_input *in;
+    struct uring_chunk chunks[URING_DEPTH];
+    struct uring_chunk *chunk;
+    struct io_uring_cqe *cqe;
+    unsigned long long read_seq = 0;
+    unsigned long long write_seq = 0;
+    unsigned long long seq;
+    size_t read_input = 0;
+    size_t write_input = 0;
+    unsigned int inflight = 0;
+    int writing = 0;
+    int failed = 0;
+    int retval = 0;
+    int status;
+    int res;
+    size_t i;
+
+    if (uring_init(&ring, URING_DEPTH * 2) == -1) {
+        return -1;
+    }
+
+    /* Writes at the current position of stdout need Linux 5.6 */
+    if (!(ring.features & IORING_FEAT_RW_CUR_POS)) {
+        uring_exit(&ring);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    inputs = calloc(count, sizeof(*inputs));
+    if (inputs == NULL ||
+        iobuf_reserve(&buffers, (URING_DEPTH + 1) * URING_CHUNK) == -1) {
+        free(inputs);
+        uring_exit(&ring);
+        return -1;
+    }
+
+    uring_chunk_size = buffers.size / (URING_DEPTH + 1);
+    uring_chunk_size -= uring_chunk_size % sysconf(_SC_PAGE_SIZE);
+    if (uring_chunk_size > URING_CHUNK) {
+        uring_chunk_size = URING_CHUNK;
+    }
+    if (uring_chunk_size == 0) {
+        free(inputs);
+        iobuf_free(&buffers);
+        uring_exit(&ring);
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        inputs[i].name = files[i];
+        inputs[i].fd = -1;
+    }
+
+    /* The extra chunk at the end is used by uring_finish */
+    for (i = 0; i < URING_DEPTH; i++) {
+        chunks[i].buf = buffers.data + i * uring_chunk_size;
+        chunks[i].ready = 0;
+    }
+
+    while (write_input < count && !failed) {
+        /* Write the chunks that are ready, in sequence */
+        while (!writing && write_seq < read_seq) {
+            chunk = &chunks[write_seq % URING_DEPTH];
+            if (!chunk->ready) break;
+
+            in = &inputs[chunk->input];
+            if (chunk->written < chunk->filled &&
+                !(in->error && chunk->offset >= in->error_offset)) {
+                uring_queue_write(&ring, chunk, write_seq);
+                writing = 1;
+                inflight++;
+                break;
+            }
+
+            chunk->ready = 0;
+            in->pending--;
+            write_seq++;
+        }
+
+        /* Complete the inputs that have been written out */
+        while (write_input < read_input && inputs[write_input].pending == 0) {
+            status = uring_finish(&inputs[write_input], buffers.data +
+                                  URING_DEPTH * uring_chunk_size);
+            if (status == -1) {
+                failed = 1;
+            }
+            if (status != 0) {
+                retval = 1;
+            }
+            write_input++;
+        }
+
+        if (failed) break;
+
+        /* Anything other than a regular file is copied once it's reached */
+        if (write_input == read_input && read_input < count &&
+            inputs[read_input].barrier) {
+            if (cat_file(inputs[read_input].name, -1)) {
+                retval = 1;
+            }
+            read_input++;
+            write_input++;
+            continue;
+        }
+
+        /* Queue reads for the following chunks, running into later files */
+        while (read_input < count && read_seq - write_seq < URING_DEPTH) {
+            in = &inputs[read_input];
+            if (!in->opened) {
+                uring_open(in);
+            }
+            if (in->barrier) break;
+
+            /* Empty files are read once, as their size may be misreported */
+            if (in->error || (in->next > 0 && in->next >= in->size)) {
+                read_input++;
+                continue;
+            }
+
+            chunk = &chunks[read_seq % URING_DEPTH];
+            chunk->input = read_input;
+            chunk->offset = in->next;
+            chunk->filled = 0;
+            chunk->written = 0;
+            chunk->ready = 0;
+            uring_queue_read(&ring, chunk, in, read_seq);
+
+            in->next += uring_chunk_size;
+            in->pending++;
+            inflight++;
+            read_seq++;
+        }
+
+        if (inflight == 0) continue;
+
+        if (uring_submit(&ring, 1) == -1) {
+            fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+            retval = 1;
+            break;
+        }
+
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            seq = cqe->user_data & ~URING_WRITE;
+            res = cqe->res;
+            chunk = &chunks[seq % URING_DEPTH];
+            in = &inputs[chunk->input];
+
+            if (cqe->user_data & URING_WRITE) {
+                uring_cqe_seen(&ring);
+                inflight--;
+                writing = 0;
+
+                if (stdout_stats) {
+                    errno = -res;
+                    stats_write_done(stdout_stats, chunk->started,
+                                     res < 0 ? -1 : res,
+                                     chunk->filled - chunk->written);
+                }
+
+                /* A short write is continued by the next pass */
+                if (res >= 0) {
+                    chunk->written += res;
+                } else if (res != -EINTR && res != -EAGAIN) {
+                    fprintf(stderr, "%s: stdout: %s\n", PROGRAM,
+                            strerror(-res));
+                    retval = 1;
+                    failed = 1;
+                }
+                continue;
+            }
+
+            uring_cqe_seen(&ring);
+
+            if (input_stats) {
+                errno = -res;
+                stats_read_done(input_stats, res < 0 ? -1 : res);
+            }
+
+            if (res == -EINTR || res == -EAGAIN) {
+                uring_queue_read(&ring, chunk, in, seq);
+                continue;
+            }
+
+            inflight--;
+
+            if (res < 0) {
+                if (!in->error || chunk->offset < in->error_offset) {
+                    in->error = -res;
+                    in->error_offset = chunk->offset;
+                }
+                chunk->ready = 1;
+                continue;
+            }
+
+            /*
+             * Stop at a short read if it reaches the size of the file, or at
+             * an empty read. Anything else is a partial read, for example
+             * from a file in /sys, so continue it.
+             */
+            chunk->filled += res;
+            if (res > 0 && chunk->filled < uring_chunk_size &&
+                (in->size == 0 || chunk->offset + (off_t)chunk->filled < in->size)) {
+                uring_queue_read(&ring, chunk, in, seq);
+                inflight++;
+                continue;
+            }
+
+            if (chunk->filled < uring_chunk_size) {
+                in->eof = 1;
+            }
+            chunk->ready = 1;
+        }
+    }
+
+    /* Let the kernel finish with the buffers before releasing them */
+    while (inflight > 0 && uring_submit(&ring, 1) != -1) {
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            uring_cqe_seen(&ring);
+            inflight--;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (inputs[i].fd != -1) {
+            close(inputs[i].fd);
+        }
+    }
+
+    free(inputs);
+    iobuf_free(&buffers);
+    uring_exit(&ring);
+
+    return retval;
+}
+#else
+static int cat_uring(char **files, size_t count)
+{
+    (void)files;
+    (void)count;
+    errno = ENOSYS;
+    return -1;
+}
+#endif /* HAVE_IO_URING */
+
+/*
+ * Prefetch stage for the per-file loop. A few threads open the upcoming
+ * operands and ask the kernel to start reading them, so that the open and
+ * first read latency of each file overlaps with copying the files before
+ * it. The files are still copied, and errors reported, in operand order by
+ * the main thread.
+ */
+struct prefetch_entry {
+    char *name;
+    int fd;         /* -1 if cat_file should open the file itself */
+    int error;      /* errno from open, reported when the file is reached */
+    int done;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* Signalled when the window moves */
+    pthread_cond_t done;        /* Signalled when an entry is done */
+    struct prefetch_entry *entries;
+    size_t count;
+    size_t next;                /* Next entry to be claimed by a thread */
+    size_t current;             /* Entry being copied by the main thread */
+    int idle;                   /* Threads waiting for the window to move */
+    int waiting;                /* Main thread is waiting for an entry */
+    int stop;
+    pthread_t threads[PREFETCH_THREADS];
+    int nthreads;
+} prefetch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Only regular files are opened ahead. Anything else is left to cat_file,
+ * since opening a FIFO or a device out of sequence has side effects.
+ */
+static void prefetch_open(struct prefetch_entry *e)
+{
+    struct stat st;
+
+    if (strcmp(e->name, "-") == 0 || stat(e->name, &st) == -1 ||
+        !S_ISREG(st.st_mode)) {
+        return;
+    }
+
+    e->fd = open(e->name, O_RDONLY | O_CLOEXEC);
+    if (e->fd == -1) {
+        e->error = errno;
+        return;
+    }
+
+    posix_fadvise(e->fd, 0, PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+}
+
+static void *prefetch_thread(void *arg)
+{
+    struct prefetch_entry *e;
+
+    (void)arg;
+
+    pthread_mutex_lock(&prefetch.lock);
+    for (;;) {
+        while (!prefetch.stop && (prefetch.next >= prefetch.count ||
+               prefetch.next >= prefetch.current + PREFETCH_WINDOW)) {
+            prefetch.idle++;
+            pthread_cond_wait(&prefetch.work, &prefetch.lock);
+            prefetch.idle--;
+        }
+        if (prefetch.stop) break;
+
+        e = &prefetch.entries[prefetch.next++];
+        pthread_mutex_unlock(&prefetch.lock);
+
+        prefetch_open(e);
+
+        pthread_mutex_lock(&prefetch.lock);
+        e->done = 1;
+        if (prefetch.waiting) {
+            pthread_cond_signal(&prefetch.done);
+        }
+    }
+    pthread_mutex_unlock(&prefetch.lock);
+
+    return NULL;
+}
+
+/*
+ * Start the prefetch threads, for PREFETCH_MIN_FILES operands or more on a
+ * machine with more than one CPU. POSIXY_CAT_PREFETCH sets how many threads
+ * to start regardless, or 0 to never start them.
+ */
+static void prefetch_start(char **files, size_t count)
+{
+    char *env = getenv("POSIXY_CAT_PREFETCH");
+    int nthreads = env ? atoi(env) : PREFETCH_THREADS;
+    pthread_attr_t attr;
+    sigset_t all;
+    sigset_t old;
+    size_t i;
+
+    prefetch.nthreads = 0;
+    if (count < 2 || nthreads <= 0) {
+        return;
+    }
+    if (env == NULL && (count < PREFETCH_MIN_FILES ||
+                        sysconf(_SC_NPROCESSORS_ONLN) < 2)) {
+        return;
+    }
+    if (nthreads > PREFETCH_THREADS) {
+        nthreads = PREFETCH_THREADS;
+    }
+
+    /* A thread for every four files is enough to keep ahead */
+    if ((size_t)nthreads > (count + 3) / 4) {
+        nthreads = (count + 3) / 4;
+    }
+
+    prefetch.entries = calloc(count, sizeof(*prefetch.entries));
+    if (prefetch.entries == NULL) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        prefetch.entries[i].name = files[i];
+        prefetch.entries[i].fd = -1;
+    }
+    prefetch.count = count;
+    prefetch.next = 0;
+    prefetch.current = 0;
+    prefetch.idle = 0;
+    prefetch.waiting = 0;
+    prefetch.stop = 0;
+
+    /* The threads only make system calls, and signals are left to main */
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PREFETCH_STACK);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (prefetch.nthreads < nthreads &&
+           pthread_create(&prefetch.threads[prefetch.nthreads], &attr,
+                          prefetch_thread, NULL) == 0) {
+        prefetch.nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (prefetch.nthreads == 0) {
+        free(prefetch.entries);
+        prefetch.entries = NULL;
+    }
+}
+
+/*
+ * Wait for entry i to be opened, and move the window along. Returns the
+ * file descriptor, or -1 with *error set if the open failed, or with *error
+ * zero if cat_file should open the file.
+ */
+static int prefetch_wait(size_t i, int *error)
+{
+    struct prefetch_entry *e;
+    int fd;
+
+    *error = 0;
+    if (prefetch.nthreads == 0) {
+        return -1;
+    }
+
+    e = &prefetch.entries[i];
+
+    pthread_mutex_lock(&prefetch.lock);
+    prefetch.current = i;
+    if (prefetch.idle) {
+        pthread_cond_signal(&prefetch.work);
+    }
+    while (!e->done) {
+        prefetch.waiting = 1;
+        pthread_cond_wait(&prefetch.done, &prefetch.lock);
+        prefetch.waiting = 0;
+    }
+    pthread_mutex_unlock(&prefetch.lock);
+
+    /* The descriptor now belongs to cat_file */
+    fd = e->fd;
+    e->fd = -1;
+    *error = e->error;
+    return fd;
+}
+
+static void prefetch_stop(void)
+{
+    size_t i;
+
+    if (prefetch.nthreads == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&prefetch.lock);
+    prefetch.stop = 1;
+    pthread_cond_broadcast(&prefetch.work);
+    pthread_mutex_unlock(&prefetch.lock);
+
+    while (prefetch.nthreads > 0) {
+        pthread_join(prefetch.threads[--prefetch.nthreads], NULL);
+    }
+
+    /* Files that were opened but not reached */
+    for (i = 0; i < prefetch.count; i++) {
+        if (prefetch.entries[i].fd != -1) {
+            close(prefetch.entries[i].fd);
+        }
+    }
+
+    free(prefetch.entries);
+    prefetch.entries = NULL;
+}
+
+/*
+ * Report the number of read and write system calls made by this process,
+ * as counted by the kernel, if POSIXY_CAT_SYSCALLS is set. This is used by
+ * the benchmarks to compare the copy methods.
+ */
+static void report_syscalls(void)
+{
+    unsigned long long reads = 0;
+    unsigned long long writes = 0;
+    char line[64];
+    FILE *io;
+
+    io = fopen("/proc/self/io", "re");
+    if (io == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), io)) {
+        sscanf(line, "syscr: %llu", &reads);
+        sscanf(line, "syscw: %llu", &writes);
+    }
+    fclose(io);
+
+    fprintf(stderr, "%s: syscalls: %llu reads, %llu writes\n", PROGRAM,
+            reads, writes);
+}
+
 int posix_cat(int argc, char **argv)
 {
     int opt;
     int retval = 0;
     char **file;
-    int call_free = 0;
-    char buffer;
+    struct stat st;
+    char *method_name;
+    char *env;
+    enum copy_method method;
+    int fd;
+    int error;
 
     unbuffered = 0;
+    debug = (getenv("POSIXY_DEBUG") != NULL);
+
+    /* Allow the copy method to be chosen, mainly for benchmarking */
+    forced_method = COPY_METHODS;
+    method_name = getenv("POSIXY_CAT_METHOD");
+    for (method = 0; method_name && method < COPY_METHODS; method++) {
+        if (strcmp(method_name, copy_method_names[method]) == 0) {
+            forced_method = method;
+        }
+    }
+
+    env = getenv("POSIXY_CAT_COALESCE");
+    coalesce = !(env && strcmp(env, "0") == 0);
+    batch_used = 0;
+
     /* Parse arguments */
     while ((opt = getopt(argc, argv, "u")) != -1) {
         switch (opt) {
@@ -197,28 +1357,28 @@ int posix_cat(int argc, char **argv)
             break;
         default:
             usage();
-            exit(EXIT_FAILURE);
-            break;
+            return EXIT_FAILURE;
         }
     }
 
-    buffer_size = sysconf(_SC_PAGE_SIZE);
-    buffer_page = mmap(NULL, buffer_size, PROT_READ | PROT_WRITE,
-                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (buffer_page == MAP_FAILED) {
-        fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+    if (unbuffered) {
+        setbuf(stdout, NULL);
+        coalesce = 0;
+    }
 
-        /* mmap failed, but try to malloc instead */
-        buffer_page = malloc(buffer_size);
-        if (buffer_page == NULL) {
-            fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
-            exit(EXIT_FAILURE);
-        }
-        call_free = 1;
+    stats_init(PROGRAM);
+    input_stats = stats_stream("input");
+    stdout_stats = stats_stream("stdout");
+
+    if (fstat(STDOUT_FILENO, &st) == 0) {
+        stdout_mode = st.st_mode;
+    } else {
+        stdout_mode = 0;
     }
 
-    if (unbuffered) {
-        setbuf(stdout, NULL);
+    /* Larger pipes mean fewer context switches with the reader */
+    if (S_ISFIFO(stdout_mode)) {
+        iobuf_tune_pipe(STDOUT_FILENO, iobuf_max());
     }
 
     if ((argc - optind) == 0) {
@@ -226,19 +1386,44 @@ int posix_cat(int argc, char **argv)
          * No additional arguments specified, handle it as if a single '-'
          * was provided for the input
          */
-        return cat_file("-");
-    }
+        retval = cat_file("-", -1);
+    } else if (forced_method == COPY_URING &&
+               (retval = cat_uring(&argv[optind], argc - optind)) != -1) {
+        /* All the operands were copied by the io_uring engine */
+    } else {
+        if (forced_method == COPY_URING && debug) {
+            fprintf(stderr, "%s: %s unavailable, using %s: %s\n", PROGRAM,
+                    copy_method_names[COPY_URING],
+                    copy_method_names[COPY_READ_WRITE], strerror(errno));
+        }
 
-    for (file = &argv[optind]; *file; file++) {
-        if (cat_file(*file)) {
-            retval = 1;
+        retval = 0;
+        prefetch_start(&argv[optind], argc - optind);
+        for (file = &argv[optind]; *file; file++) {
+            fd = prefetch_wait(file - &argv[optind], &error);
+            if (error) {
+                batch_flush();
+                fprintf(stderr, "%s: %s: %s\n", PROGRAM, *file,
+                        strerror(error));
+                retval = 1;
+            } else if (cat_file(*file, fd)) {
+                retval = 1;
+            }
         }
+        prefetch_stop();
     }
 
-    if (call_free) {
-        free(buffer_page);
-    } else {
-        munmap(buffer_page, buffer_size);
+    if (batch_flush()) {
+        retval = 1;
+    }
+
+    if (getenv("POSIXY_CAT_SYSCALLS")) {
+        report_syscalls();
     }
+
+    stats_finish();
+
+    iobuf_free(&batch);
+    iobuf_free(&buffer_page);
     return retval;
 }
@@ -43,6 +43,19 @@ OPTIONS
 
     None.
 
+    As an extension, if no string operand is given, each line of the
+    standard input is taken as a string, and the result for it written as a
+    line to the standard output. The following option applies to this mode:
+
+    -z
+        Strings are terminated by NUL characters rather than newlines, both
+        on the standard input and on the standard output.
+
+    The options are only recognized when they are the only arguments.
+    Otherwise all of the arguments are operands, even those that begin
+    with '-', as POSIX defines no options. A first argument of "--" is
+    skipped.
+
 OPERANDS
 
     The following operand shall be supported:
@@ -52,7 +65,7 @@ OPERANDS
 
 STDIN
 
-    Not used.
+    Not used, except as an extension. See OPTIONS.
 
 INPUT FILES
 
@@ -122,103 +135,92 @@ CONSEQUENCES OF ERRORS
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-int posix_dirname(int argc, char **argv)
+#include "pathname.h"
+#include "records.h"
+
+#define PROGRAM     "dirname"
+
+/*
+ * Steps 1 to 8 on a string of len bytes, which need not be terminated.
+ * Returns the result, which points into the string or to a constant, and
+ * sets *result_len.
+ */
+static const char *dirname_of(const char *string, size_t len,
+                              size_t *result_len, void *arg)
 {
-    int i;
-    int only_slashes;
-    char *string_ptr;
-    char *tmp_ptr;
-    size_t string_len;
-
-    if (argc != 2) {
-        fprintf(stderr, "Usage: dirname string\n");
-        return 1;
-    }
+    struct pathname split;
 
-    string_ptr = strdup(argv[1]);
-    string_len = strlen(argv[1]);
+    (void)arg;
 
-    setbuf(stdout, NULL);
-step1:
-    /* Check if string is // */
-    if (strcmp(string_ptr, "//") == 0) {
-        goto step6;
-    }
+    pathname_split(string, len, &split);
+    *result_len = 1;
 
-step2:
-    /* Check if the string consists of only slashes */
-    for (tmp_ptr = argv[1], only_slashes = 1; *tmp_ptr; tmp_ptr++) {
-        if (*tmp_ptr != '/') {
-            only_slashes = 0;
-            break;
-        }
+    /*
+     * Steps 1 and 2, // and any other string of slashes give /. Step 4
+     * gives . for a single component, and for the null string too.
+     */
+    if (split.base_end == 0) {
+        return len ? "/" : ".";
+    } else if (split.base_start == 0) {
+        return ".";
     }
 
-    if (only_slashes) {
-        string_ptr[1] = '\0';
-        goto output;
+    /* Steps 3, 5 and 7 leave the directory, step 8 turns / into / */
+    if (split.dir_end == 0) {
+        return "/";
     }
 
-step3:
-    /* Step 3, remove any trailing slashes */
-    for (i = string_len - 1; i >= 0; i++) {
-        if (string_ptr[i] == '/') {
-            string_ptr[i] = '\0';
-        } else {
-            break;
-        }
-    }
+    *result_len = split.dir_end;
+    return string;
+}
 
-    string_len = strlen(string_ptr);
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s string\n"
+                    "       %s [-z] < strings\n", PROGRAM, PROGRAM);
+}
+
+int posix_dirname(int argc, char **argv)
+{
+    const char *result;
+    size_t result_len;
+    int delimiter = '\n';
+    int streaming = 1;
+    int first;
+    int opt;
 
-step4:
     /*
-     * Check for any slash characters left in the string.
-     * If none, set to single period character
+     * Options stop at the first operand, and only count if nothing else
+     * follows them, so that a string such as -foo/bar is an operand
      */
-    if (strchr(string_ptr, '/') == NULL) {
-        free(string_ptr);
-        puts(".");
-        return 0;
-    }
-
-step5:
-    /* Step 5, remove any trailing non-slashes */
-    for (i = string_len - 1; i >= 0; i--) {
-        if (string_ptr[i] != '/') {
-            string_ptr[i] = '\0';
-        } else {
+    opterr = 0;
+    while (streaming && (opt = getopt(argc, argv, "+z")) != -1) {
+        switch (opt) {
+        case 'z':
+            delimiter = '\0';
             break;
-        }
-    }
 
-    string_len = strlen(string_ptr);
-
-step6:
-    /* If remaining string is //, implementation defined to process steps 7,8 */
-    /* IMPLEMENTATION SPECIFIC: Process 7 & 8 regardless of string */
-step7:
-    /* Remove trailing slash characters */
-    for (i = string_len - 1; i >= 0; i++) {
-        if (string_ptr[i] == '/') {
-            string_ptr[i] = '\0';
-        } else {
+        default:
+            streaming = 0;
             break;
         }
     }
 
-    string_len = strlen(string_ptr);
+    /* With no string, map each line or NUL terminated string on stdin */
+    if (streaming && optind == argc) {
+        return records_map(STDIN_FILENO, STDOUT_FILENO, delimiter,
+                           dirname_of, NULL, PROGRAM);
+    }
 
-step8:
-    /* If string is empty, set it to "/" */
-    if (string_len == 0) {
-        string_ptr[0] = '/';
-        string_len = 1;
+    first = (argc > 1 && strcmp(argv[1], "--") == 0) ? 2 : 1;
+    if (argc - first != 1) {
+        usage();
+        return 1;
     }
 
-output:
-    puts(string_ptr);
-    free(string_ptr);
+    result = dirname_of(argv[first], strlen(argv[first]), &result_len, NULL);
+    printf("%.*s\n", (int)result_len, result);
     return 0;
 }
@@ -85,28 +85,331 @@ CONSEQUENCES OF ERRORS
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PROGRAM         "logname"
+
+#define LOGINUID_FILE   "/proc/self/loginuid"
+#define PASSWD_FILE     "/etc/passwd"
+
+/*
+ * The login name is looked up in this order, where each step is skipped
+ * if it can't give an answer:
+ *
+ *  passwd      The audit login uid from /proc/self/loginuid, which is set
+ *              at login and inherited from then on, looked up in a mapping
+ *              of /etc/passwd
+ *  getlogin    getlogin(3). glibc tries the same uid through getpwuid(3),
+ *              which covers users from NIS, LDAP and so on but sets up NSS
+ *              to do so, and then scans utmp for the controlling terminal.
+ *
+ * POSIXY_LOGNAME_METHOD can be set to one of these to use only that step,
+ * for timing them.
+ */
+enum method {
+    METHOD_ALL,
+    METHOD_PASSWD,
+    METHOD_GETLOGIN,
+};
+
+/* A user in the mapping of the passwd file */
+struct passwd_entry {
+    uid_t uid;
+    size_t name;                    /* Offset of the name in the file */
+    size_t name_len;
+};
+
+/*
+ * Mapping of the passwd file. It is kept from one call to the next, for
+ * posixy --batch, for as long as the file doesn't change. The index makes
+ * a single lookup no cheaper than a scan of the file, because building and
+ * sorting the index costs more than one linear scan. So the first lookup
+ * scans, and the index, sorted by uid, is only built on the second lookup.
+ */
+static struct {
+    char *map;
+    size_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct passwd_entry *entries;
+    size_t count;
+    int lookups;
+} passwd_view;
+
+/* Get the audit login uid, returns -1 if it isn't set */
+static int read_loginuid(uid_t *uid)
+{
+    char buf[32];
+    char *end;
+    unsigned long value;
+    ssize_t len;
+    int fd;
+
+    fd = open(LOGINUID_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+
+    /* (uid_t)-1 means that the process isn't part of a login session */
+    errno = 0;
+    value = strtoul(buf, &end, 10);
+    if (errno || end == buf || (uid_t)value != value ||
+        (uid_t)value == (uid_t)-1) {
+        return -1;
+    }
+
+    *uid = value;
+    return 0;
+}
+
+static void passwd_close(void)
+{
+    if (passwd_view.map) {
+        munmap(passwd_view.map, passwd_view.size);
+    }
+    free(passwd_view.entries);
+    memset(&passwd_view, 0, sizeof(passwd_view));
+}
+
+/* Map the passwd file, or keep the current mapping if it is unchanged */
+static int passwd_open(void)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(PASSWD_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (passwd_view.map && st.st_dev == passwd_view.dev &&
+        st.st_ino == passwd_view.ino &&
+        (size_t)st.st_size == passwd_view.size &&
+        st.st_mtim.tv_sec == passwd_view.mtime.tv_sec &&
+        st.st_mtim.tv_nsec == passwd_view.mtime.tv_nsec) {
+        close(fd);
+        return 0;
+    }
+
+    passwd_close();
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    passwd_view.map = map;
+    passwd_view.size = st.st_size;
+    passwd_view.dev = st.st_dev;
+    passwd_view.ino = st.st_ino;
+    passwd_view.mtime = st.st_mtim;
+    return 0;
+}
+
+/*
+ * Parse the line at *pos into an entry, and move *pos to the next line.
+ * Returns 0 for a user, or -1 for anything else, such as a comment or the
+ * +/- entries of NIS compat mode.
+ */
+static int passwd_parse(size_t *pos, struct passwd_entry *entry)
+{
+    const char *line = passwd_view.map + *pos;
+    const char *end = passwd_view.map + passwd_view.size;
+    const char *eol;
+    const char *colon;
+    const char *field;
+    unsigned long uid = 0;
+
+    eol = memchr(line, '\n', end - line);
+    if (eol == NULL) {
+        eol = end;
+    }
+    *pos = eol - passwd_view.map + (eol < end);
+
+    if (line == eol || *line == '#' || *line == '+' || *line == '-') {
+        return -1;
+    }
+
+    /* The name, then the password, then the uid */
+    colon = memchr(line, ':', eol - line);
+    if (colon == NULL || colon == line) {
+        return -1;
+    }
+    entry->name = line - passwd_view.map;
+    entry->name_len = colon - line;
+
+    field = memchr(colon + 1, ':', eol - colon - 1);
+    if (field == NULL || ++field == eol || *field == ':') {
+        return -1;
+    }
+    for (; field < eol && *field != ':'; field++) {
+        if (*field < '0' || *field > '9' || uid > ((uid_t)-1) / 10) {
+            return -1;
+        }
+        uid = uid * 10 + (*field - '0');
+    }
+
+    entry->uid = uid;
+    return 0;
+}
+
+static int compare_entry(const void *a, const void *b)
+{
+    const struct passwd_entry *x = a;
+    const struct passwd_entry *y = b;
+
+    /* The first entry for a uid wins, as with getpwuid */
+    if (x->uid != y->uid) {
+        return x->uid < y->uid ? -1 : 1;
+    }
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+static int passwd_index(void)
+{
+    struct passwd_entry entry;
+    struct passwd_entry *entries;
+    size_t lines = 1;
+    size_t pos = 0;
+    size_t i;
+
+    for (i = 0; i < passwd_view.size; i++) {
+        lines += passwd_view.map[i] == '\n';
+    }
+
+    entries = malloc(lines * sizeof(*entries));
+    if (entries == NULL) {
+        return -1;
+    }
+
+    passwd_view.count = 0;
+    while (pos < passwd_view.size) {
+        if (passwd_parse(&pos, &entry) == 0) {
+            entries[passwd_view.count++] = entry;
+        }
+    }
+
+    qsort(entries, passwd_view.count, sizeof(*entries), compare_entry);
+    passwd_view.entries = entries;
+    return 0;
+}
+
+/* Find the name of a user in the passwd file, returns -1 if not found */
+static int passwd_lookup(uid_t uid, const char **name, size_t *name_len)
+{
+    struct passwd_entry entry;
+    size_t low;
+    size_t high;
+    size_t mid;
+    size_t pos = 0;
+
+    if (passwd_open() == -1) {
+        return -1;
+    }
+
+    if (passwd_view.entries == NULL && passwd_view.lookups++ > 0) {
+        passwd_index();
+    }
+
+    if (passwd_view.entries == NULL) {
+        while (pos < passwd_view.size) {
+            if (passwd_parse(&pos, &entry) == 0 && entry.uid == uid) {
+                *name = passwd_view.map + entry.name;
+                *name_len = entry.name_len;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    /* The first of the entries for the uid */
+    low = 0;
+    high = passwd_view.count;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (passwd_view.entries[mid].uid < uid) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == passwd_view.count || passwd_view.entries[low].uid != uid) {
+        return -1;
+    }
+
+    *name = passwd_view.map + passwd_view.entries[low].name;
+    *name_len = passwd_view.entries[low].name_len;
+    return 0;
+}
+
+static enum method get_method(void)
+{
+    char *env = getenv("POSIXY_LOGNAME_METHOD");
+
+    if (env == NULL) {
+        return METHOD_ALL;
+    } else if (strcmp(env, "passwd") == 0) {
+        return METHOD_PASSWD;
+    } else if (strcmp(env, "getlogin") == 0) {
+        return METHOD_GETLOGIN;
+    }
+
+    return METHOD_ALL;
+}
 
 int posix_logname(int argc, char **argv)
 {
-    char *logname;
+    enum method method = get_method();
+    const char *logname = NULL;
+    size_t len = 0;
+    uid_t uid;
+
+    (void)argv;
 
     if (argc != 1) {
-        fprintf(stderr, "Usage: logname\n");
+        fprintf(stderr, "Usage: %s\n", PROGRAM);
         return EXIT_FAILURE;
     }
 
-    errno = 0;
-    logname = getlogin();
-    if (logname == NULL) {
-        if (errno != 0) {
-            fprintf(stderr, "logname: %s\n", strerror(errno));
+    if (method != METHOD_GETLOGIN && read_loginuid(&uid) == 0) {
+        passwd_lookup(uid, &logname, &len);
+    }
+
+    if (logname == NULL && (method == METHOD_ALL || method == METHOD_GETLOGIN)) {
+        errno = 0;
+        logname = getlogin();
+        if (logname == NULL && errno != 0) {
+            fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
             return EXIT_FAILURE;
-        } else {
-            fprintf(stderr, "logname: Unable to get login name\n");
         }
+        len = logname ? strlen(logname) : 0;
+    }
+
+    if (logname == NULL) {
+        fprintf(stderr, "%s: Unable to get login name\n", PROGRAM);
+        return EXIT_FAILURE;
     }
 
-    puts(logname);
+    printf("%.*s\n", (int)len, logname);
 
     return EXIT_SUCCESS;
 }
@@ -16,6 +16,13 @@ OPTIONS
 
     None.
 
+    As an extension, sleep --every time [--count n] writes a line to the
+    standard output every time seconds, n times or until it is terminated.
+    Each line has the number of the tick, counting from 1, and the number of
+    ticks missed since the previous line. If the standard output is a pipe,
+    a tick that comes while the previous line is still unread is counted as
+    missed rather than written.
+
 OPERANDS
 
     The following operand shall be supported:
@@ -24,6 +31,9 @@ OPERANDS
         A non-negative decimal integer specifying the number of seconds for
         which to suspend execution.
 
+        As an extension, the number may have a fraction, and may be followed
+        by s, m, h or d for seconds, minutes, hours or days.
+
 STDIN
 
     Not used.
@@ -102,43 +112,418 @@ CONSEQUENCES OF ERRORS
  **********************************************************************
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef HAVE_TIMERFD_CREATE
+#include <sys/timerfd.h>
+#endif
+
+#define PROGRAM     "sleep"
+
+/* Longest sleep, so that the deadline can't overflow, about 30 years */
+#define MAX_SECONDS     1e9
 
-static int sig_received = 0;
+/* Spin for at most this long in the low-jitter mode */
+#define MAX_SPIN_NS     10000000L
+
+static volatile sig_atomic_t sig_received = 0;
 
 static void sigalarm_handler(int signal)
 {
+    (void)signal;
     sig_received = 1;
 }
 
+/*
+ * Parse a duration: a non-negative decimal number of seconds, which may have
+ * a fraction, and may be followed by s for seconds, m for minutes, h for
+ * hours or d for days. Returns -1 if it isn't valid.
+ */
+static int parse_duration(const char *arg, double *seconds)
+{
+    char *end;
+    double value;
+
+    errno = 0;
+    value = strtod(arg, &end);
+
+    /* strtod would also take a sign, exponents, hexadecimal, inf and nan */
+    if (errno || end == arg || end != arg + strspn(arg, "0123456789.")) {
+        return -1;
+    }
+
+    switch (*end) {
+    case '\0':
+    case 's':
+        break;
+    case 'm':
+        value *= 60;
+        break;
+    case 'h':
+        value *= 60 * 60;
+        break;
+    case 'd':
+        value *= 24 * 60 * 60;
+        break;
+    default:
+        return -1;
+    }
+
+    if (*end && end[1]) {
+        return -1;
+    }
+
+    *seconds = value < MAX_SECONDS ? value : MAX_SECONDS;
+    return 0;
+}
+
+static void timespec_add_ns(struct timespec *ts, long long ns)
+{
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec += ns % 1000000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    } else if (ts->tv_nsec < 0) {
+        ts->tv_sec--;
+        ts->tv_nsec += 1000000000;
+    }
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * Length of the spin at the end of the sleep in the low-jitter mode, set by
+ * POSIXY_SLEEP_SPIN in microseconds, 0 if it is off. In this mode the timer
+ * slack is also cut to a nanosecond, so that the kernel doesn't defer the
+ * wakeup by the default 50us to batch it with others. The old slack is
+ * saved in slack, to be put back by the caller, or -1 if it wasn't changed.
+ */
+static long spin_ns(long *slack)
+{
+    char *env = getenv("POSIXY_SLEEP_SPIN");
+    long spin;
+
+    *slack = -1;
+    if (env == NULL || *env == '\0') {
+        return 0;
+    }
+
+    spin = atol(env) * 1000;
+    if (spin < 0) {
+        spin = 0;
+    } else if (spin > MAX_SPIN_NS) {
+        spin = MAX_SPIN_NS;
+    }
+
+#ifdef PR_SET_TIMERSLACK
+    *slack = prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+#endif
+
+    return spin;
+}
+
+/*
+ * Sleep until the deadline on CLOCK_MONOTONIC. The deadline is absolute, so
+ * waking up for a signal and going back to sleep doesn't add any drift.
+ * Returns early if SIGALRM is received.
+ */
+static void sleep_until(const struct timespec *deadline, long spin)
+{
+    struct timespec wake = *deadline;
+    struct timespec now;
+
+    timespec_add_ns(&wake, -spin);
+
+    while (!sig_received &&
+           clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) != 0) {
+        /* Interrupted by a signal that didn't terminate us, go back */
+    }
+
+    if (spin == 0) {
+        return;
+    }
+
+    /* Spin out the last stretch, which a timer can't hit precisely */
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (!sig_received && timespec_before(&now, deadline));
+}
+
+/* State of sleep --every */
+struct ticker {
+    unsigned long long ticks;       /* Deadlines gone by */
+    unsigned long long count;       /* Deadlines to wait for, 0 for no end */
+    unsigned long long missed;      /* Ticks not written since the last line */
+    int pipe;                       /* Standard output is a pipe or socket */
+};
+
+/*
+ * Check whether the previous line is still unread. A reader that hasn't
+ * kept up would otherwise find a backlog of stale ticks in the pipe, and
+ * fall further and further behind.
+ */
+static int unread(const struct ticker *t)
+{
+    int pending;
+
+    return t->pipe && ioctl(STDOUT_FILENO, FIONREAD, &pending) == 0 &&
+           pending > 0;
+}
+
+/*
+ * Account for the given number of deadlines gone by, and write a line for
+ * the last of them unless the reader is still busy with the previous one.
+ * The last tick is always written. Returns -1 on error.
+ */
+static int write_tick(struct ticker *t, unsigned long long expired)
+{
+    char line[64];
+    int len;
+    ssize_t written;
+
+    t->ticks += expired;
+    t->missed += expired - 1;
+    if (t->count && t->ticks > t->count) {
+        t->missed -= t->ticks - t->count;
+        t->ticks = t->count;
+    }
+
+    if (t->ticks != t->count && unread(t)) {
+        t->missed++;
+        return 0;
+    }
+
+    len = snprintf(line, sizeof(line), "%llu %llu\n", t->ticks, t->missed);
+    t->missed = 0;
+
+    do {
+        written = write(STDOUT_FILENO, line, len);
+    } while (written == -1 && errno == EINTR && !sig_received);
+
+    if (written == -1 && sig_received) {
+        return 0;
+    }
+    if (written != len) {
+        fprintf(stderr, "%s: %s\n", PROGRAM,
+                written == -1 ? strerror(errno) : "short write");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Periodic mode, for sleep --every: write a line to stdout at each of the
+ * deadlines first, first + period, first + 2 * period and so on, up to count
+ * of them, or forever if count is 0. The deadlines are absolute, so the time
+ * taken by whoever reads the lines doesn't add up. Ticks that come while the
+ * reader is busy with the previous line are counted as missed instead.
+ */
+static int tick(const struct timespec *first, const struct timespec *period,
+                unsigned long long count)
+{
+    struct ticker t;
+    struct stat st;
+    unsigned long long expired;
+#ifdef HAVE_TIMERFD_CREATE
+    struct itimerspec spec;
+    ssize_t got;
+    int retval = 0;
+    int fd;
+#else
+    struct timespec deadline = *first;
+    struct timespec now;
+#endif
+
+    memset(&t, 0, sizeof(t));
+    t.count = count;
+    t.pipe = fstat(STDOUT_FILENO, &st) == 0 &&
+             (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+
+#ifdef HAVE_TIMERFD_CREATE
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+        return 1;
+    }
+
+    spec.it_value = *first;
+    spec.it_interval = *period;
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+        fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    while (!sig_received && (count == 0 || t.ticks < count)) {
+        got = read(fd, &expired, sizeof(expired));
+        if (got == -1 && errno == EINTR) {
+            continue;
+        } else if (got != sizeof(expired)) {
+            fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+            retval = 1;
+            break;
+        }
+
+        if (write_tick(&t, expired) == -1) {
+            retval = 1;
+            break;
+        }
+    }
+
+    close(fd);
+    return retval;
+#else
+    while (!sig_received && (count == 0 || t.ticks < count)) {
+        sleep_until(&deadline, 0);
+        if (sig_received) {
+            break;
+        }
+
+        /* Skip over the deadlines that have already gone by */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        expired = 0;
+        do {
+            timespec_add_ns(&deadline, period->tv_sec * 1000000000LL +
+                                       period->tv_nsec);
+            expired++;
+        } while (!timespec_before(&now, &deadline));
+
+        if (write_tick(&t, expired) == -1) {
+            return 1;
+        }
+    }
+
+    return 0;
+#endif
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s <seconds>\n"
+                    "       %s --every <seconds> [--count <ticks>]\n",
+            PROGRAM, PROGRAM);
+}
+
+/*
+ * Get the value of an option, given either as --name=value or as --name
+ * followed by the value. Returns NULL if arg isn't this option, and advances
+ * *i past the value if it is.
+ */
+static const char *option_value(int argc, char **argv, int *i,
+                                const char *name)
+{
+    size_t len = strlen(name);
+
+    if (strncmp(argv[*i], name, len) != 0) {
+        return NULL;
+    }
+
+    if (argv[*i][len] == '=') {
+        return argv[*i] + len + 1;
+    } else if (argv[*i][len] == '\0' && *i + 1 < argc) {
+        return argv[++*i];
+    }
+
+    return NULL;
+}
+
 int posix_sleep(int argc, char **argv)
 {
-    int sleep_time;
-    int time_remaining;
+    struct timespec deadline;
+    struct timespec period;
+    const char *duration = NULL;
+    const char *every = NULL;
+    const char *value;
+    unsigned long long count = 0;
+    double seconds;
+    char *end;
+    long spin;
+    long slack;
+    int retval = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if ((value = option_value(argc, argv, &i, "--every")) != NULL) {
+            every = value;
+        } else if ((value = option_value(argc, argv, &i, "--count")) != NULL) {
+            errno = 0;
+            count = strtoull(value, &end, 10);
+            if (errno || end == value || *end || *value == '-' || count == 0) {
+                fprintf(stderr, "%s: Invalid count '%s'\n", PROGRAM, value);
+                return (EXIT_FAILURE);
+            }
+        } else if (duration == NULL && strncmp(argv[i], "--", 2) != 0) {
+            duration = argv[i];
+        } else {
+            usage();
+            return (EXIT_FAILURE);
+        }
+    }
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: sleep <seconds>\n");
+    /* Either a time to sleep, or a period to tick at */
+    if ((duration == NULL) == (every == NULL) || (count && every == NULL)) {
+        usage();
         return (EXIT_FAILURE);
     }
 
-    if (sscanf(argv[1], "%d", &time_remaining) < 1) {
-        fprintf(stderr, "sleep: Invalid time value '%s'\n", argv[1]);
+    if (every) {
+        duration = every;
+    }
+
+    if (parse_duration(duration, &seconds) == -1 ||
+        (every && seconds < 1e-6)) {
+        fprintf(stderr, "%s: Invalid time value '%s'\n", PROGRAM, duration);
         return (EXIT_FAILURE);
     }
 
+    sig_received = 0;
+
     /* Catch SIGALRM */
     signal(SIGALRM, sigalarm_handler);
 
-    for (;;) {
-        time_remaining = sleep(time_remaining);
+    spin = spin_ns(&slack);
 
-        if ((time_remaining == 0) || (sig_received == 1)) {
-            break;
-        }
+    period.tv_sec = (time_t)seconds;
+    period.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9 + 0.5);
+    if (period.tv_nsec >= 1000000000) {
+        period.tv_sec++;
+        period.tv_nsec -= 1000000000;
     }
 
-    return 0;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += period.tv_sec;
+    timespec_add_ns(&deadline, period.tv_nsec);
+
+    if (every) {
+        retval = tick(&deadline, &period, count);
+    } else {
+        sleep_until(&deadline, spin);
+    }
+
+#ifdef PR_SET_TIMERSLACK
+    /* In posixy --batch, later commands get the usual slack */
+    if (slack > 0) {
+        prctl(PR_SET_TIMERSLACK, (unsigned long)slack, 0UL, 0UL, 0UL);
+    }
+#endif
+
+    return retval;
 }
@@ -107,6 +107,7 @@ CONSEQUENCES OF ERRORS
 
  **********************************************************************
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -117,31 +118,1018 @@ CONSEQUENCES OF ERRORS
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+#include "iobuf.h"
+#include "outfile.h"
+#include "stats.h"
+#include "uring.h"
 
 #define PROGRAM     "tee"
 
+/* stdout as an output like the files, and the counters for stdin */
+static struct outfile stdout_file;
+static struct stats_stream *stdin_stats;
+
 static void usage(void)
 {
     fprintf(stderr, "Usage: %s [-ai] [file...]\n", PROGRAM);
 }
 
+/*
+ * Write to one of the tee files. If that fails, report it and stop writing
+ * to the file, rather than repeating the error for every block of input.
+ */
+static int write_file(struct outfile *out, const char *buf, size_t len)
+{
+    if (outfile_write(out, buf, len) == -1) {
+        fprintf(stderr, "%s: %s: %s\n", PROGRAM, out->name, strerror(errno));
+        outfile_close(out);
+        return 1;
+    }
+
+    return 0;
+}
+
+#if defined(HAVE_TEE) && defined(HAVE_SPLICE)
+/* Read exactly len bytes from stdin, returns -1 on error */
+static int read_block(char *buf, size_t len)
+{
+    ssize_t bytes_read;
+
+    while (len > 0) {
+        bytes_read = stats_read(stdin_stats, STDIN_FILENO, buf, len);
+        if (bytes_read == -1 && errno == EINTR) continue;
+        if (bytes_read <= 0) {
+            if (bytes_read == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+
+        buf += bytes_read;
+        len -= bytes_read;
+    }
+
+    return 0;
+}
+
+/* Check that stdin, stdout and all the open tee files are pipes */
+static int all_pipes(struct outfile *files, int tee_files)
+{
+    struct stat st;
+    int i;
+
+    if (fstat(STDIN_FILENO, &st) == -1 || !S_ISFIFO(st.st_mode) ||
+        fstat(STDOUT_FILENO, &st) == -1 || !S_ISFIFO(st.st_mode)) {
+        return 0;
+    }
+
+    for (i = 0; i < tee_files; i++) {
+        if (files[i].fd != -1 &&
+            (fstat(files[i].fd, &st) == -1 || !S_ISFIFO(st.st_mode))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Copy stdin to stdout and the tee files when they are all pipes, without
+ * passing the data through userspace. tee(2) duplicates the buffers at the
+ * head of stdin into stdout and all but the last file, and splice(2) then
+ * moves them into the last file, which consumes them from stdin. With no
+ * tee files, stdin is simply spliced to stdout.
+ *
+ * tee(2) always duplicates from the head of the pipe, so if it only
+ * duplicates part of the data into a file, the rest can't be duplicated
+ * separately. In that case the data is read into buf instead, and the
+ * remainder written from there.
+ *
+ * Returns 0 at the end of the input or on a read error, or -1 if the rest
+ * should be copied by the buffered loop. That happens on any error from
+ * stdin or stdout, with nothing consumed from stdin, and the buffered loop
+ * then reports genuine errors as usual. Errors writing to the files are
+ * reported here.
+ */
+static int tee_zero_copy(struct outfile *files, int tee_files,
+                         struct iobuf *buf, int *retval)
+{
+    int *outs;
+    int *copied;
+    int nouts;
+    int last;
+    int short_copy;
+    ssize_t len;
+    ssize_t bytes;
+    size_t done;
+    unsigned long long start;
+    int result = -1;
+    int i;
+
+    outs = calloc(tee_files + 1, sizeof(int));
+    copied = calloc(tee_files + 1, sizeof(int));
+    if (outs == NULL || copied == NULL) {
+        free(outs);
+        free(copied);
+        return -1;
+    }
+
+    for (;;) {
+        /* outs[0] is stdout, followed by the files that are still open */
+        nouts = 0;
+        outs[nouts++] = -1;
+        for (i = 0; i < tee_files; i++) {
+            if (files[i].fd != -1) {
+                outs[nouts++] = i;
+            }
+        }
+        last = nouts - 1;
+
+        start = stats_begin(stdout_file.stats);
+        if (nouts == 1) {
+            len = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, buf->size,
+                         SPLICE_F_MOVE);
+        } else {
+            len = tee(STDIN_FILENO, STDOUT_FILENO, buf->size, 0);
+        }
+        if (stdout_file.stats) {
+            stats_copy_done(nouts == 1 ? stdin_stats : NULL, stdout_file.stats,
+                            start, len);
+        }
+
+        if (len == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (len == 0) {
+            result = 0;
+            break;
+        }
+
+        if (nouts == 1) continue;
+
+        /* Duplicate the same data into all but the last file */
+        short_copy = 0;
+        for (i = 1; i < last; i++) {
+            do {
+                start = stats_begin(files[outs[i]].stats);
+                bytes = tee(STDIN_FILENO, files[outs[i]].fd, len, 0);
+                if (files[outs[i]].stats) {
+                    stats_copy_done(NULL, files[outs[i]].stats, start, bytes);
+                }
+            } while (bytes == -1 && errno == EINTR);
+
+            copied[i] = (bytes == -1) ? 0 : bytes;
+            if (copied[i] < len) {
+                short_copy = 1;
+            }
+        }
+
+        if (short_copy) {
+            /* Take the data off stdin, and finish the copies from there */
+            if (read_block(buf->data, len) == -1) {
+                fprintf(stderr, "%s: stdin: %s\n", PROGRAM, strerror(errno));
+                *retval = 1;
+                result = 0;
+                break;
+            }
+
+            for (i = 1; i < last; i++) {
+                if (copied[i] < len) {
+                    *retval |= write_file(&files[outs[i]],
+                                          buf->data + copied[i],
+                                          len - copied[i]);
+                }
+            }
+
+            *retval |= write_file(&files[outs[last]], buf->data, len);
+            continue;
+        }
+
+        /* Move the data into the last file, which consumes it from stdin */
+        for (done = 0; done < (size_t)len; done += bytes) {
+            start = stats_begin(files[outs[last]].stats);
+            bytes = splice(STDIN_FILENO, NULL, files[outs[last]].fd, NULL,
+                           len - done, SPLICE_F_MOVE);
+            if (files[outs[last]].stats) {
+                stats_copy_done(stdin_stats, files[outs[last]].stats, start,
+                                bytes);
+            }
+            if (bytes == -1) {
+                if (errno == EINTR) {
+                    bytes = 0;
+                    continue;
+                }
+
+                /* Let write report the error for the rest of the data */
+                if (read_block(buf->data, len - done) == -1) {
+                    fprintf(stderr, "%s: stdin: %s\n", PROGRAM,
+                            strerror(errno));
+                    *retval = 1;
+                    result = 0;
+                    goto out;
+                }
+                *retval |= write_file(&files[outs[last]], buf->data,
+                                      len - done);
+                break;
+            }
+        }
+    }
+
+out:
+    free(outs);
+    free(copied);
+    return result;
+}
+#endif
+
+/*
+ * Decoupled mode, enabled by setting POSIXY_TEE_BACKPRESSURE
+ *
+ * The input is read into a ring buffer, and each output (sink) is written
+ * from the ring by its own thread, with its own position in the ring. A
+ * slow output then only holds up the others once the ring is full, which
+ * is when the backpressure policy applies to the file holding it up:
+ *
+ *  block   wait for the file to catch up, as the synchronous loop does
+ *  spill   keep the data for that file in a temporary file in $TMPDIR,
+ *          up to POSIXY_TEE_SPILL_MAX bytes behind, until it catches up.
+ *          The file's own thread moves its data from the ring to the
+ *          spill file, so the reader and stdout never wait on that disk.
+ *  detach  stop writing to that file, and exit with a non-zero status
+ *
+ * stdout always blocks. The size of the ring is set by POSIXY_TEE_RING.
+ */
+enum backpressure {
+    BACKPRESSURE_NONE,
+    BACKPRESSURE_BLOCK,
+    BACKPRESSURE_SPILL,
+    BACKPRESSURE_DETACH,
+};
+
+enum sink_mode {
+    SINK_RING,          /* Written from the ring */
+    SINK_SPILL,         /* Moved from the ring to the spill file, and written
+                           from there */
+    SINK_DETACHED,      /* Dropped for being too slow */
+    SINK_FAILED,        /* A write failed */
+};
+
+struct sink {
+    struct outfile *out;
+    pthread_t thread;
+    enum sink_mode mode;
+    unsigned long long tail;        /* Position in the ring written up to */
+    unsigned long long busy;        /* End of the range being written */
+    int spill_fd;
+    unsigned long long spill_read;
+    unsigned long long spill_written;
+    char *spill_buf;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t data;            /* Signalled when the head moves */
+    pthread_cond_t space;           /* Signalled when a sink moves */
+    struct iobuf buf;
+    unsigned long long head;        /* Position in the ring read up to */
+    int eof;
+    int failed;                     /* Some sink failed or was detached */
+    enum backpressure policy;
+    unsigned long long spill_max;
+    struct sink *sinks;
+    int nsinks;
+} ring = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .data = PTHREAD_COND_INITIALIZER,
+    .space = PTHREAD_COND_INITIALIZER,
+};
+
+/* Most data handed to one read or write, so that the others keep moving */
+#define RING_CHUNK          (1024 * 1024)
+#define RING_DEFAULT_SIZE   (16 * 1024 * 1024)
+#define SPILL_DEFAULT_MAX   (1024ULL * 1024 * 1024)
+#define SINK_STACK          (64 * 1024)
+
+/*
+ * Most data written to a slow file from its spill file at a time, so that
+ * its thread soon gets back to moving new data out of the ring
+ */
+#define SPILL_CHUNK         (64 * 1024)
+
+/* Oldest position in the ring that is still needed, called with the lock */
+static unsigned long long ring_tail(void)
+{
+    unsigned long long tail = ring.head;
+    int i;
+
+    for (i = 0; i < ring.nsinks; i++) {
+        if ((ring.sinks[i].mode == SINK_RING ||
+             ring.sinks[i].mode == SINK_SPILL ||
+             ring.sinks[i].busy > ring.sinks[i].tail) &&
+            ring.sinks[i].tail < tail) {
+            tail = ring.sinks[i].tail;
+        }
+    }
+
+    return tail;
+}
+
+/* Stop writing to a sink, called with the lock */
+static void sink_detach(struct sink *sink, const char *reason)
+{
+    fprintf(stderr, "%s: %s: %s, detached\n", PROGRAM, sink->out->name,
+            reason);
+    sink->mode = SINK_DETACHED;
+    ring.failed = 1;
+    pthread_cond_broadcast(&ring.data);
+    pthread_cond_broadcast(&ring.space);
+}
+
+/*
+ * Create the spill file of a sink and its buffer, if it has none yet.
+ * Called by the sink's thread without the lock, returns -1 on error.
+ */
+static int spill_open(struct sink *sink)
+{
+    char path[256];
+    const char *tmpdir = getenv("TMPDIR");
+
+    if (sink->spill_fd == -1) {
+        snprintf(path, sizeof(path), "%s/posixy-tee-XXXXXX",
+                 tmpdir && *tmpdir ? tmpdir : "/tmp");
+        sink->spill_fd = mkostemp(path, O_CLOEXEC);
+        if (sink->spill_fd == -1) {
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (sink->spill_buf == NULL) {
+        sink->spill_buf = malloc(SPILL_CHUNK);
+        if (sink->spill_buf == NULL) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Append len bytes from the ring to the spill file at pos, without the lock */
+static int spill_append(struct sink *sink, const char *buf, size_t len,
+                        unsigned long long pos)
+{
+    ssize_t bytes_written;
+
+    while (len > 0) {
+        bytes_written = pwrite(sink->spill_fd, buf, len, pos);
+        if (bytes_written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        buf += bytes_written;
+        len -= bytes_written;
+        pos += bytes_written;
+    }
+
+    return 0;
+}
+
+static void *sink_thread(void *arg)
+{
+    struct sink *sink = arg;
+    unsigned long long start;
+    unsigned long long pos;
+    size_t len;
+    ssize_t bytes_read;
+    unsigned long long spilled = 0;
+    int error;
+
+    pthread_mutex_lock(&ring.lock);
+    for (;;) {
+        if (sink->mode == SINK_DETACHED || sink->mode == SINK_FAILED) break;
+
+        /*
+         * A spilling sink moves its data out of the ring first, up to the
+         * size of the ring between writes from the spill file, so that
+         * both move
+         */
+        if (sink->mode == SINK_SPILL && sink->tail < ring.head &&
+            (spilled < ring.buf.size ||
+             sink->spill_read == sink->spill_written)) {
+            start = sink->tail;
+            len = ring.buf.size - start % ring.buf.size;
+            if (len > ring.head - start) {
+                len = ring.head - start;
+            }
+            if (len > RING_CHUNK) {
+                len = RING_CHUNK;
+            }
+
+            if (sink->spill_written - sink->spill_read + len >
+                ring.spill_max) {
+                sink_detach(sink, "spill file full");
+                break;
+            }
+
+            pos = sink->spill_written;
+            sink->busy = start + len;
+            pthread_mutex_unlock(&ring.lock);
+
+            error = 0;
+            if (spill_open(sink) == -1 ||
+                spill_append(sink, ring.buf.data + start % ring.buf.size,
+                             len, pos) == -1) {
+                error = errno;
+            }
+
+            pthread_mutex_lock(&ring.lock);
+            sink->tail = sink->busy;
+            if (error) {
+                sink_detach(sink, strerror(error));
+                break;
+            }
+            sink->spill_written += len;
+            spilled += len;
+            pthread_cond_broadcast(&ring.space);
+            continue;
+        }
+
+        if (sink->mode == SINK_SPILL && sink->spill_read < sink->spill_written) {
+            start = sink->spill_read;
+            len = sink->spill_written - start;
+            if (len > SPILL_CHUNK) {
+                len = SPILL_CHUNK;
+            }
+            pthread_mutex_unlock(&ring.lock);
+
+            error = 0;
+            bytes_read = pread(sink->spill_fd, sink->spill_buf, len, start);
+            if (bytes_read <= 0) {
+                error = bytes_read ? errno : EIO;
+            } else if (outfile_write(sink->out, sink->spill_buf, bytes_read) == -1) {
+                error = errno;
+            }
+
+            pthread_mutex_lock(&ring.lock);
+            if (error) {
+                fprintf(stderr, "%s: %s: %s\n", PROGRAM, sink->out->name,
+                        strerror(error));
+                sink->mode = SINK_FAILED;
+                ring.failed = 1;
+                pthread_cond_broadcast(&ring.space);
+                break;
+            }
+            sink->spill_read += bytes_read;
+            spilled = 0;
+            pthread_mutex_unlock(&ring.lock);
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+            /* Give back the disk space of what has been written out */
+            fallocate(sink->spill_fd, FALLOC_FL_PUNCH_HOLE |
+                      FALLOC_FL_KEEP_SIZE, start, bytes_read);
+#endif
+
+            pthread_mutex_lock(&ring.lock);
+            continue;
+        }
+
+        /* Caught up with the ring and the spill file, go back to the ring */
+        if (sink->mode == SINK_SPILL) {
+            sink->mode = SINK_RING;
+            sink->spill_read = 0;
+            sink->spill_written = 0;
+            pthread_mutex_unlock(&ring.lock);
+
+            if (ftruncate(sink->spill_fd, 0) == -1) {
+                /* The space will be reused anyway */
+            }
+
+            pthread_mutex_lock(&ring.lock);
+            continue;
+        }
+
+        if (sink->mode == SINK_RING && sink->tail < ring.head) {
+            start = sink->tail;
+            len = ring.buf.size - start % ring.buf.size;
+            if (len > ring.head - start) {
+                len = ring.head - start;
+            }
+            if (len > RING_CHUNK) {
+                len = RING_CHUNK;
+            }
+            sink->busy = start + len;
+            pthread_mutex_unlock(&ring.lock);
+
+            error = 0;
+            if (outfile_write(sink->out, ring.buf.data + start % ring.buf.size,
+                              len) == -1) {
+                error = errno;
+            }
+
+            pthread_mutex_lock(&ring.lock);
+            sink->tail = sink->busy;
+            if (error) {
+                fprintf(stderr, "%s: %s: %s\n", PROGRAM, sink->out->name,
+                        strerror(error));
+                sink->mode = SINK_FAILED;
+                ring.failed = 1;
+            }
+            pthread_cond_broadcast(&ring.space);
+            continue;
+        }
+
+        if (ring.eof) break;
+
+        pthread_cond_wait(&ring.data, &ring.lock);
+    }
+    pthread_mutex_unlock(&ring.lock);
+
+    return NULL;
+}
+
+/*
+ * Wait until there is room in the ring, applying the backpressure policy
+ * to any file that is holding it up. Called with the lock, returns the
+ * number of bytes that can be read, or 0 if stdout has failed.
+ */
+static size_t ring_wait(void)
+{
+    unsigned long long full;
+    struct sink *sink;
+    int changed;
+    int i;
+
+    for (;;) {
+        if (ring.sinks[0].mode == SINK_FAILED) {
+            return 0;
+        }
+
+        full = ring_tail() + ring.buf.size;
+        if (ring.head < full) {
+            return full - ring.head;
+        }
+
+        changed = 0;
+        for (i = 1; ring.policy != BACKPRESSURE_BLOCK && i < ring.nsinks; i++) {
+            sink = &ring.sinks[i];
+            if (sink->mode != SINK_RING || sink->tail + ring.buf.size > ring.head) {
+                continue;
+            }
+
+            /* Its thread spills once its current write returns */
+            if (ring.policy == BACKPRESSURE_DETACH) {
+                sink_detach(sink, "output too slow");
+            } else {
+                sink->mode = SINK_SPILL;
+            }
+            changed = 1;
+        }
+
+        if (!changed) {
+            pthread_cond_wait(&ring.space, &ring.lock);
+        }
+    }
+}
+
+/*
+ * Copy stdin to stdout and the files in decoupled mode. Returns -1 with
+ * nothing read from stdin if the threads can't be started, so that the
+ * synchronous loop can be used instead.
+ */
+static int tee_decoupled(struct outfile *files, int tee_files)
+{
+    pthread_attr_t attr;
+    sigset_t all;
+    sigset_t old;
+    unsigned long long size = RING_DEFAULT_SIZE;
+    struct sink *sink;
+    ssize_t bytes_read;
+    size_t offset;
+    size_t len;
+    int started;
+    int retval = 0;
+    int i;
+
+    if (iobuf_parse_size(getenv("POSIXY_TEE_RING"), &size) == -1 ||
+        size < RING_CHUNK) {
+        size = RING_DEFAULT_SIZE;
+    }
+    if (iobuf_parse_size(getenv("POSIXY_TEE_SPILL_MAX"),
+                         &ring.spill_max) == -1) {
+        ring.spill_max = SPILL_DEFAULT_MAX;
+    }
+
+    ring.buf.data = NULL;
+    if (iobuf_alloc(&ring.buf, size) == -1) {
+        return -1;
+    }
+
+    /* Sink 0 is stdout, followed by the files that are open */
+    ring.sinks = calloc(tee_files + 1, sizeof(struct sink));
+    if (ring.sinks == NULL) {
+        iobuf_free(&ring.buf);
+        return -1;
+    }
+
+    ring.nsinks = 0;
+    ring.sinks[ring.nsinks++].out = &stdout_file;
+    for (i = 0; i < tee_files; i++) {
+        if (files[i].fd != -1) {
+            ring.sinks[ring.nsinks++].out = &files[i];
+        }
+    }
+
+    for (i = 0; i < ring.nsinks; i++) {
+        ring.sinks[i].mode = SINK_RING;
+        ring.sinks[i].spill_fd = -1;
+    }
+
+    ring.head = 0;
+    ring.eof = 0;
+    ring.failed = 0;
+
+    /* The threads only make system calls, and signals are left to main */
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SINK_STACK);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (started = 0; started < ring.nsinks; started++) {
+        sink = &ring.sinks[started];
+        if (pthread_create(&sink->thread, &attr, sink_thread, sink) != 0) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (started < ring.nsinks) {
+        retval = -1;
+        pthread_mutex_lock(&ring.lock);
+        goto done;
+    }
+
+    pthread_mutex_lock(&ring.lock);
+    for (;;) {
+        len = ring_wait();
+        if (len == 0) break;
+
+        offset = ring.head % ring.buf.size;
+        if (len > ring.buf.size - offset) {
+            len = ring.buf.size - offset;
+        }
+        if (len > RING_CHUNK) {
+            len = RING_CHUNK;
+        }
+        pthread_mutex_unlock(&ring.lock);
+
+        bytes_read = stats_read(stdin_stats, STDIN_FILENO,
+                                ring.buf.data + offset, len);
+
+        pthread_mutex_lock(&ring.lock);
+        if (bytes_read == 0) break;
+        if (bytes_read == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "%s: stdin: %s\n", PROGRAM, strerror(errno));
+            retval = 1;
+            break;
+        }
+
+        ring.head += bytes_read;
+        pthread_cond_broadcast(&ring.data);
+    }
+
+done:
+    ring.eof = 1;
+    pthread_cond_broadcast(&ring.data);
+    pthread_mutex_unlock(&ring.lock);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(ring.sinks[i].thread, NULL);
+    }
+
+    for (i = 0; i < ring.nsinks; i++) {
+        sink = &ring.sinks[i];
+        if (sink->spill_fd != -1) {
+            close(sink->spill_fd);
+        }
+        free(sink->spill_buf);
+    }
+
+    if (retval != -1 && (ring.failed || ring.sinks[0].mode == SINK_FAILED)) {
+        retval = 1;
+    }
+
+    free(ring.sinks);
+    ring.sinks = NULL;
+    iobuf_free(&ring.buf);
+    return retval;
+}
+
+#ifdef HAVE_IO_URING
+/* Number of chunks of input that the io_uring fan-out keeps in flight */
+#define URING_DEPTH         8
+
+/* A chunk of input, shared by the writes to all the outputs */
+struct uring_chunk {
+    char *data;
+    size_t len;
+    int refs;                       /* Outputs still to write it */
+};
+
+/* An output, which has at most one write in flight to keep them in order */
+struct uring_output {
+    struct outfile *file;
+    unsigned long long next;        /* Sequence of the next chunk to write */
+    size_t done;                    /* Bytes of that chunk written */
+    unsigned long long started;     /* When the write was queued, for stats */
+    int busy;
+    int failed;
+};
+
+/*
+ * Copy stdin to stdout and the files with io_uring. Each chunk is read
+ * into one of URING_DEPTH registered buffers, and the writes of that chunk
+ * to all the outputs are submitted with a single io_uring_enter. Each
+ * output has one write in flight at a time, so that its data stays in
+ * order, but fast outputs can run up to URING_DEPTH chunks ahead of slow
+ * ones before reading stops.
+ *
+ * Errors are reported per output as in the synchronous loop, and an error
+ * writing to stdout stops the copy. Returns -1 with nothing read from
+ * stdin if io_uring can't be used.
+ */
+static int tee_uring(struct outfile *files, int tee_files, int *retval)
+{
+    struct uring ring;
+    struct iobuf buffers = { NULL, 0, 0 };
+    struct uring_chunk chunks[URING_DEPTH];
+    struct uring_output *outputs;
+    struct uring_output *out;
+    struct uring_chunk *chunk;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct iovec iov;
+    unsigned long long read_seq = 0;
+    unsigned long long oldest = 0;
+    unsigned long long seq;
+    size_t chunk_size;
+    ssize_t bytes_read;
+    unsigned int inflight = 0;
+    int noutputs;
+    int fixed;
+    int eof = 0;
+    int i;
+
+    /* The writes go straight to the files, without the output options */
+    for (i = 0; i < tee_files; i++) {
+        if (files[i].features != 0) {
+            return -1;
+        }
+    }
+
+    noutputs = tee_files + 1;
+    if (uring_init(&ring, noutputs < 4096 ? noutputs : 4096) == -1) {
+        return -1;
+    }
+
+    /* Writes at the current position of each output need Linux 5.6 */
+    if (!(ring.features & IORING_FEAT_RW_CUR_POS) ||
+        ring.entries < (unsigned int)noutputs) {
+        uring_exit(&ring);
+        return -1;
+    }
+
+    chunk_size = iobuf_size_hint(STDIN_FILENO, STDOUT_FILENO);
+    outputs = calloc(noutputs, sizeof(*outputs));
+    if (outputs == NULL ||
+        iobuf_alloc(&buffers, URING_DEPTH * chunk_size) == -1) {
+        free(outputs);
+        uring_exit(&ring);
+        return -1;
+    }
+
+    /* Registered buffers save pinning the pages for every write */
+    iov.iov_base = buffers.data;
+    iov.iov_len = buffers.size;
+    fixed = (uring_register_buffers(&ring, &iov, 1) == 0);
+
+    for (i = 0; i < URING_DEPTH; i++) {
+        chunks[i].data = buffers.data + i * chunk_size;
+        chunks[i].refs = 0;
+    }
+
+    outputs[0].file = &stdout_file;
+    for (i = 0; i < tee_files; i++) {
+        outputs[i + 1].file = &files[i];
+        outputs[i + 1].failed = (files[i].fd == -1);
+    }
+
+    for (;;) {
+        /* Read the next chunk if there is one free */
+        if (!eof && read_seq - oldest < URING_DEPTH) {
+            chunk = &chunks[read_seq % URING_DEPTH];
+            bytes_read = stats_read(stdin_stats, STDIN_FILENO, chunk->data,
+                                    chunk_size);
+            if (bytes_read == -1 && errno == EINTR) continue;
+            if (bytes_read == -1) {
+                fprintf(stderr, "%s: stdin: %s\n", PROGRAM, strerror(errno));
+                *retval = 1;
+            }
+
+            if (bytes_read <= 0) {
+                eof = 1;
+            } else {
+                chunk->len = bytes_read;
+                chunk->refs = 0;
+                for (i = 0; i < noutputs; i++) {
+                    chunk->refs += !outputs[i].failed;
+                }
+                read_seq++;
+            }
+        }
+
+        /* Queue the next write for each idle output */
+        for (i = 0; i < noutputs; i++) {
+            out = &outputs[i];
+            if (out->failed || out->busy || out->next == read_seq) continue;
+
+            chunk = &chunks[out->next % URING_DEPTH];
+            sqe = uring_get_sqe(&ring);
+            if (fixed) {
+                uring_prep_rw(sqe, IORING_OP_WRITE_FIXED, out->file->fd,
+                              chunk->data + out->done, chunk->len - out->done,
+                              -1);
+                sqe->buf_index = 0;
+            } else {
+                uring_prep_rw(sqe, IORING_OP_WRITE, out->file->fd,
+                              chunk->data + out->done, chunk->len - out->done,
+                              -1);
+            }
+            sqe->user_data = i;
+            out->started = stats_begin(out->file->stats);
+            out->busy = 1;
+            inflight++;
+        }
+
+        if (inflight == 0) {
+            if (eof) break;
+            continue;
+        }
+
+        /*
+         * Submit the writes of this chunk in one go, and only wait for
+         * them if there is nothing more to read
+         */
+        if (uring_submit(&ring, (eof || read_seq - oldest == URING_DEPTH) ?
+                         1 : 0) == -1) {
+            fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+            *retval = 1;
+            break;
+        }
+
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            out = &outputs[cqe->user_data];
+            chunk = &chunks[out->next % URING_DEPTH];
+            out->busy = 0;
+            inflight--;
+
+            if (out->file->stats) {
+                errno = -cqe->res;
+                stats_write_done(out->file->stats, out->started,
+                                 cqe->res < 0 ? -1 : cqe->res,
+                                 chunk->len - out->done);
+            }
+
+            if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+                /* Queued again on the next pass */
+            } else if (cqe->res <= 0) {
+                fprintf(stderr, "%s: %s: %s\n", PROGRAM, out->file->name,
+                        strerror(cqe->res ? -cqe->res : ENOSPC));
+                *retval = 1;
+                out->failed = 1;
+
+                /* Let go of the chunks this output hadn't written */
+                for (seq = out->next; seq < read_seq; seq++) {
+                    chunks[seq % URING_DEPTH].refs--;
+                }
+
+                if (out == &outputs[0]) {
+                    eof = 1;
+                } else {
+                    outfile_close(out->file);
+                }
+            } else {
+                out->done += cqe->res;
+                if (out->done == chunk->len) {
+                    out->done = 0;
+                    out->next++;
+                    chunk->refs--;
+                }
+            }
+            uring_cqe_seen(&ring);
+        }
+
+        while (oldest < read_seq && chunks[oldest % URING_DEPTH].refs == 0) {
+            oldest++;
+        }
+
+        /* After a failure on stdout, only wait for the writes in flight */
+        if (outputs[0].failed) {
+            for (i = 0; i < noutputs; i++) {
+                outputs[i].failed = 1;
+            }
+        }
+    }
+
+    /* Let the kernel finish with the buffers before releasing them */
+    while (inflight > 0 && uring_submit(&ring, 1) != -1) {
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            uring_cqe_seen(&ring);
+            inflight--;
+        }
+    }
+
+    free(outputs);
+    iobuf_free(&buffers);
+    uring_exit(&ring);
+    return 0;
+}
+#endif
+
+/*
+ * Options for writing the files to disk, for long streams that would
+ * otherwise build up dirty pages and stall in writeback, or grow without
+ * bound:
+ *
+ *  POSIXY_TEE_DIRECT       set to 1 to write with O_DIRECT
+ *  POSIXY_TEE_PREALLOC     allocate the files in extents of this size
+ *  POSIXY_TEE_WRITEBEHIND  flush every this many bytes as they are written
+ *  POSIXY_TEE_ROTATE       move each file to file.1, file.2 and so on each
+ *                          time it reaches this size
+ *  POSIXY_TEE_SIGHUP       set to reopen to reopen the files on SIGHUP,
+ *                          rather than exit, for use with logrotate
+ *
+ * The sizes are in bytes with an optional K, M or G suffix. Returns NULL if
+ * none of them are set.
+ */
+static struct outfile_options *output_options(void)
+{
+    static struct outfile_options options;
+    char *env = getenv("POSIXY_TEE_DIRECT");
+
+    options.direct = (env && strcmp(env, "1") == 0);
+    env = getenv("POSIXY_TEE_SIGHUP");
+    options.reopen = (env && strcmp(env, "reopen") == 0);
+    if (iobuf_parse_size(getenv("POSIXY_TEE_PREALLOC"),
+                         &options.prealloc) == -1) {
+        options.prealloc = 0;
+    }
+    if (iobuf_parse_size(getenv("POSIXY_TEE_WRITEBEHIND"),
+                         &options.writebehind) == -1) {
+        options.writebehind = 0;
+    }
+    if (iobuf_parse_size(getenv("POSIXY_TEE_ROTATE"),
+                         &options.rotate) == -1) {
+        options.rotate = 0;
+    }
+
+    if (!options.direct && options.prealloc == 0 &&
+        options.writebehind == 0 && options.rotate == 0 && !options.reopen) {
+        return NULL;
+    }
+
+    return &options;
+}
+
+static void reopen_handler(int signal)
+{
+    (void)signal;
+    outfile_request_reopen();
+}
+
 int posix_tee(int argc, char **argv)
 {
     int opt;
     int i;
     int retval = 0;
     char *file;
-    int call_free = 0;
-    char buffer;
     int tee_files;
-    int *fds = NULL;
+    struct outfile *files = NULL;
+    struct outfile_options *options;
+    struct sigaction sa;
     int open_flags = O_TRUNC;
+    int status;
+    char *method;
 
-    char *buffer_page;
-    size_t buffer_size;
+    struct iobuf buffer_page = { NULL, 0, 0 };
+    struct stat st;
 
-    int bytes_read;
-    int bytes_written;
+    ssize_t bytes_read;
 
     /* Parse arguments */
     while ((opt = getopt(argc, argv, "ai")) != -1) {
@@ -154,53 +1142,106 @@ int posix_tee(int argc, char **argv)
             break;
         default:
             usage();
-            exit(EXIT_FAILURE);
-            break;
+            return EXIT_FAILURE;
         }
     }
 
-    buffer_size = sysconf(_SC_PAGE_SIZE);
-    buffer_page = mmap(NULL, buffer_size, PROT_READ | PROT_WRITE,
-                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (buffer_page == MAP_FAILED) {
+    if (iobuf_reserve(&buffer_page,
+                      iobuf_size_hint(STDIN_FILENO, STDOUT_FILENO)) == -1) {
         fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
-        
-        /* mmap failed, but try to malloc instead */
-        buffer_page = malloc(buffer_size);
-        if (buffer_page == NULL) {
-            fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
-            exit(EXIT_FAILURE);
-        }
-        call_free = 1;
+        return EXIT_FAILURE;
     }
     setbuf(stdout, NULL);
 
+    stats_init(PROGRAM);
+    stdin_stats = stats_stream("stdin");
+    outfile_wrap(&stdout_file, STDOUT_FILENO, "stdout");
+    stdout_file.stats = stats_stream("stdout");
+
+    /* Larger pipes mean fewer context switches with the reader */
+    if (fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        iobuf_tune_pipe(STDOUT_FILENO, iobuf_max());
+    }
+
     tee_files = argc - optind;
     if (tee_files != 0) {
-        /* Allocate an array for the file descriptors */
-        fds = calloc(sizeof(int), tee_files);
+        /* Allocate an array for the files */
+        files = calloc(sizeof(struct outfile), tee_files);
 
-        if (fds == NULL) {
+        if (files == NULL) {
             fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
-            exit(EXIT_FAILURE);
+            retval = 1;
+            goto out;
         }
 
         /* Open files for writing */
+        options = output_options();
+        if (options && options->reopen) {
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = reopen_handler;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGHUP, &sa, NULL);
+        }
+
         for (i = 0; i < tee_files; i++) {
             file = argv[optind + i];
-            fds[i] = open(file, O_CREAT | O_WRONLY | open_flags,
-                          S_IRWXU | S_IRWXG | S_IRWXO);
-
-            if (fds[i] == -1) {
+            if (outfile_open(&files[i], file, open_flags, options) == -1) {
                 fprintf(stderr, "%s: %s: %s\n", PROGRAM, file, strerror(errno));
                 retval = 1;
+            } else {
+                files[i].stats = stats_stream(file);
+                if (fstat(files[i].fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+                    iobuf_tune_pipe(files[i].fd, iobuf_max());
+                }
             }
         }
     }
 
+    /* Decoupled mode, with a thread for each output */
+    method = getenv("POSIXY_TEE_BACKPRESSURE");
+    ring.policy = BACKPRESSURE_NONE;
+    if (method && strcmp(method, "block") == 0) {
+        ring.policy = BACKPRESSURE_BLOCK;
+    } else if (method && strcmp(method, "spill") == 0) {
+        ring.policy = BACKPRESSURE_SPILL;
+    } else if (method && strcmp(method, "detach") == 0) {
+        ring.policy = BACKPRESSURE_DETACH;
+    }
+
+    if (ring.policy != BACKPRESSURE_NONE) {
+        status = tee_decoupled(files, tee_files);
+        if (status != -1) {
+            retval |= status;
+            goto done;
+        }
+    }
+
+    method = getenv("POSIXY_TEE_METHOD");
+
+#ifdef HAVE_IO_URING
+    /* Batch the writes to all the outputs with io_uring */
+    if (method && strcmp(method, "io_uring") == 0 &&
+        tee_uring(files, tee_files, &retval) == 0) {
+        goto done;
+    }
+#endif
+
+#if defined(HAVE_TEE) && defined(HAVE_SPLICE)
+    /*
+     * Pipes all round can be copied without touching the data, unless
+     * POSIXY_TEE_METHOD asks for another method, mainly for benchmarking
+     */
+    if ((method == NULL || strcmp(method, "tee") == 0) &&
+        all_pipes(files, tee_files) &&
+        tee_zero_copy(files, tee_files, &buffer_page, &retval) == 0) {
+        goto done;
+    }
+#endif
+
     /* Read from stdin and write to stdout, followed by additional files */
     for (;;) {
-        bytes_read = read(STDIN_FILENO, buffer_page, buffer_size);
+        bytes_read = stats_read(stdin_stats, STDIN_FILENO, buffer_page.data,
+                                buffer_page.size);
         if (bytes_read == 0) break;
         if (bytes_read == -1) {
             /* If the read failed because it was interrupted by a signal,
@@ -212,35 +1253,39 @@ int posix_tee(int argc, char **argv)
             break;
         }
 
-        bytes_written = write(STDOUT_FILENO, buffer_page, buffer_size);
-        if (bytes_written == -1) {
+        if (outfile_write(&stdout_file, buffer_page.data, bytes_read) == -1) {
             fprintf(stderr, "%s: stdout: %s\n", PROGRAM, strerror(errno));
             retval = 1;
             break;
         }
 
         for (i = 0; i < tee_files; i++) {
-            /* Write to each of the tee files */
-            bytes_written = write(fds[i], buffer_page, buffer_size);
-            if (bytes_written == -1) {
-                fprintf(stderr, "%s: %s: %s\n", PROGRAM, argv[optind + i],
-                        strerror(errno));
-                retval = 1;
+            /* Write to each of the tee files that is still open */
+            if (files[i].fd != -1) {
+                retval |= write_file(&files[i], buffer_page.data, bytes_read);
             }
         }
+
+        /* A full buffer means that there is more to come, read bigger chunks */
+        if ((size_t)bytes_read == buffer_page.size) {
+            iobuf_grow(&buffer_page);
+        }
     }
 
-    /* Close all opened files */
+done:
+    /* Close all opened files, which may still have data to write */
     for (i = 0; i < tee_files; i++) {
-        close(fds[i]);
+        if (outfile_close(&files[i]) == -1) {
+            fprintf(stderr, "%s: %s: %s\n", PROGRAM, files[i].name,
+                    strerror(errno));
+            retval = 1;
+        }
     }
 
-    free(fds);
+    free(files);
 
-    if (call_free) {
-        free(buffer_page);
-    } else {
-        munmap(buffer_page, buffer_size);
-    }
+out:
+    stats_finish();
+    iobuf_free(&buffer_page);
     return retval;
 }
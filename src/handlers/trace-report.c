@@ -0,0 +1,404 @@
+/**********************************************************************
+NAME
+
+    trace-report - summarize posixy trace files
+
+SYNOPSIS
+
+    trace-report [file...]
+
+DESCRIPTION
+
+    The trace-report utility shall read the records written by posixy to the
+    file named by POSIXY_TRACE, and write a table to the standard output with
+    a line for each command, summarizing where the time of its calls went.
+
+    This utility is not part of POSIX.
+
+OPTIONS
+
+    None.
+
+OPERANDS
+
+    The following operand shall be supported:
+
+    file
+        A pathname of a trace file. If no file operands are specified, the
+        standard input shall be used. If a file is '-', the standard input
+        shall be read at that point in the sequence.
+
+STDIN
+
+    The standard input shall be used only if no file operands are specified,
+    or if a file operand is '-'.
+
+INPUT FILES
+
+    Trace files, as written by posixy with POSIXY_TRACE set.
+
+ENVIRONMENT VARIABLES
+
+    None.
+
+ASYNCHRONOUS EVENTS
+
+    Default.
+
+STDOUT
+
+    A header line, followed by a line for each command, in order of the total
+    time spent in it. The columns are:
+
+    COMMAND     the command
+    CALLS       the number of calls
+    EXEC        median and 99th percentile of the CPU time before the handler
+                was called, in microseconds
+    HANDLER     median and 99th percentile of the time spent in the handler,
+                in microseconds
+    EXIT        median and 99th percentile of the time from the handler
+                returning to the process exiting, in microseconds
+    USER, SYS   mean user and system CPU time, in microseconds
+    RSS         largest maximum resident set size, in kilobytes
+    MINFLT      mean minor page faults
+    CYCLES, INSNS, FAULTS
+                mean cycles, instructions and page faults counted by perf
+                events, or '-' where they were not available
+
+STDERR
+
+    The standard error shall be used only for diagnostic messages.
+
+OUTPUT FILES
+
+    None.
+
+EXTENDED DESCRIPTION
+
+    None.
+
+EXIT STATUS
+
+    The following exit values shall be returned:
+
+     0
+        All the files were read successfully.
+    >0
+        An error occurred, or a file contained invalid records.
+
+CONSEQUENCES OF ERRORS
+
+    Records that are not valid are skipped, and the rest of the file is read.
+
+ **********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "trace.h"
+
+#define PROGRAM     "trace-report"
+
+/* The records read so far */
+static struct trace_record *records;
+static size_t record_count;
+static size_t record_space;
+
+/* Summary of the calls of one command */
+struct summary {
+    const char *command;
+    size_t calls;
+    uint64_t total_ns;
+    uint64_t exec[2];               /* Median and 99th percentile */
+    uint64_t handler[2];
+    uint64_t exit[2];
+    double user_us;
+    double system_us;
+    uint64_t max_rss_kb;
+    double minor_faults;
+    double counters[3];             /* Mean, or -1 if not available */
+};
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s [file...]\n", PROGRAM);
+}
+
+static int add_record(const struct trace_record *record)
+{
+    struct trace_record *bigger;
+    size_t space;
+
+    if (record_count == record_space) {
+        space = record_space ? record_space * 2 : 1024;
+        bigger = realloc(records, space * sizeof(*records));
+        if (bigger == NULL) {
+            return -1;
+        }
+        records = bigger;
+        record_space = space;
+    }
+
+    records[record_count] = *record;
+    records[record_count].command[sizeof(record->command) - 1] = '\0';
+    record_count++;
+    return 0;
+}
+
+/* Read all the records from fd, returns the number of invalid ones or -1 */
+static long read_records(int fd, const char *name)
+{
+    struct trace_record record;
+    size_t have = 0;
+    long invalid = 0;
+    ssize_t got;
+
+    for (;;) {
+        got = read(fd, (char *)&record + have, sizeof(record) - have);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        } else if (got == -1) {
+            fprintf(stderr, "%s: %s: %s\n", PROGRAM, name, strerror(errno));
+            return -1;
+        } else if (got == 0) {
+            break;
+        }
+
+        have += got;
+        if (have < sizeof(record)) {
+            continue;
+        }
+        have = 0;
+
+        if (record.magic != TRACE_MAGIC || record.version != TRACE_VERSION ||
+            record.size != sizeof(record)) {
+            invalid++;
+            continue;
+        }
+
+        if (add_record(&record) == -1) {
+            fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+            return -1;
+        }
+    }
+
+    /* A record cut short, by a full disk or a process killed mid-write */
+    if (have) {
+        invalid++;
+    }
+
+    return invalid;
+}
+
+static int compare_command(const void *a, const void *b)
+{
+    return strcmp(((const struct trace_record *)a)->command,
+                  ((const struct trace_record *)b)->command);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int compare_total(const void *a, const void *b)
+{
+    uint64_t x = ((const struct summary *)a)->total_ns;
+    uint64_t y = ((const struct summary *)b)->total_ns;
+
+    return x > y ? -1 : x < y;
+}
+
+/* Median and 99th percentile of n values, which are sorted in place */
+static void percentiles(uint64_t *values, size_t n, uint64_t result[2])
+{
+    qsort(values, n, sizeof(*values), compare_u64);
+    result[0] = values[(n - 1) / 2];
+    result[1] = values[(n - 1) * 99 / 100];
+}
+
+/* Summarize n records of the same command, using values as scratch space */
+static void summarize(const struct trace_record *r, size_t n,
+                      uint64_t *values, struct summary *s)
+{
+    size_t counted[3] = { 0, 0, 0 };
+    uint64_t counter;
+    size_t i;
+    int j;
+
+    memset(s, 0, sizeof(*s));
+    s->command = r[0].command;
+    s->calls = n;
+
+    for (i = 0; i < n; i++) {
+        s->total_ns += r[i].handler_ns + r[i].exit_ns;
+        s->user_us += r[i].user_us;
+        s->system_us += r[i].system_us;
+        s->minor_faults += r[i].minor_faults;
+        if (r[i].max_rss_kb > s->max_rss_kb) {
+            s->max_rss_kb = r[i].max_rss_kb;
+        }
+
+        for (j = 0; j < 3; j++) {
+            counter = j == 0 ? r[i].cycles :
+                      j == 1 ? r[i].instructions : r[i].page_faults;
+            if (counter != TRACE_UNAVAILABLE) {
+                s->counters[j] += counter;
+                counted[j]++;
+            }
+        }
+    }
+
+    s->user_us /= n;
+    s->system_us /= n;
+    s->minor_faults /= n;
+    for (j = 0; j < 3; j++) {
+        s->counters[j] = counted[j] ? s->counters[j] / counted[j] : -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        values[i] = r[i].exec_ns;
+    }
+    percentiles(values, n, s->exec);
+
+    for (i = 0; i < n; i++) {
+        values[i] = r[i].handler_ns;
+    }
+    percentiles(values, n, s->handler);
+
+    for (i = 0; i < n; i++) {
+        values[i] = r[i].exit_ns;
+    }
+    percentiles(values, n, s->exit);
+}
+
+static void print_counter(double value)
+{
+    if (value < 0) {
+        printf(" %10s", "-");
+    } else {
+        printf(" %10.0f", value);
+    }
+}
+
+static void report(void)
+{
+    struct summary *summaries;
+    uint64_t *values;
+    size_t count = 0;
+    size_t start;
+    size_t i;
+
+    qsort(records, record_count, sizeof(*records), compare_command);
+
+    summaries = malloc(record_count * sizeof(*summaries));
+    values = malloc(record_count * sizeof(*values));
+    if (summaries == NULL || values == NULL) {
+        fprintf(stderr, "%s: %s\n", PROGRAM, strerror(errno));
+        free(summaries);
+        free(values);
+        return;
+    }
+
+    for (start = 0; start < record_count; start = i) {
+        for (i = start + 1; i < record_count; i++) {
+            if (strcmp(records[i].command, records[start].command) != 0) {
+                break;
+            }
+        }
+        summarize(records + start, i - start, values, &summaries[count++]);
+    }
+
+    qsort(summaries, count, sizeof(*summaries), compare_total);
+
+    printf("%-15s %7s %9s %9s %9s %9s %9s %9s %8s %8s %7s %7s "
+           "%10s %10s %10s\n", "COMMAND", "CALLS", "EXEC50", "EXEC99",
+           "HANDLER50", "HANDLER99", "EXIT50", "EXIT99", "USER", "SYS",
+           "RSS", "MINFLT", "CYCLES", "INSNS", "FAULTS");
+
+    for (i = 0; i < count; i++) {
+        printf("%-15s %7zu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8.1f %8.1f "
+               "%7llu %7.1f", summaries[i].command, summaries[i].calls,
+               summaries[i].exec[0] / 1e3, summaries[i].exec[1] / 1e3,
+               summaries[i].handler[0] / 1e3, summaries[i].handler[1] / 1e3,
+               summaries[i].exit[0] / 1e3, summaries[i].exit[1] / 1e3,
+               summaries[i].user_us, summaries[i].system_us,
+               (unsigned long long)summaries[i].max_rss_kb,
+               summaries[i].minor_faults);
+        print_counter(summaries[i].counters[0]);
+        print_counter(summaries[i].counters[1]);
+        print_counter(summaries[i].counters[2]);
+        printf("\n");
+    }
+
+    free(summaries);
+    free(values);
+}
+
+int posix_trace_report(int argc, char **argv)
+{
+    static char *standard_input[] = { "-" };
+    char **files;
+    int file_count;
+    int retval = 0;
+    long invalid;
+    int fd;
+    int i;
+
+    records = NULL;
+    record_count = 0;
+    record_space = 0;
+
+    if (getopt(argc, argv, "") != -1) {
+        usage();
+        return 1;
+    }
+
+    files = argv + optind;
+    file_count = argc - optind;
+    if (file_count == 0) {
+        files = standard_input;
+        file_count = 1;
+    }
+
+    for (i = 0; i < file_count; i++) {
+        if (strcmp(files[i], "-") == 0) {
+            fd = STDIN_FILENO;
+        } else {
+            fd = open(files[i], O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                fprintf(stderr, "%s: %s: %s\n", PROGRAM, files[i],
+                        strerror(errno));
+                retval = 1;
+                continue;
+            }
+        }
+
+        invalid = read_records(fd, files[i]);
+        if (invalid) {
+            retval = 1;
+        }
+        if (invalid > 0) {
+            fprintf(stderr, "%s: %s: %ld invalid records skipped\n",
+                    PROGRAM, files[i], invalid);
+        }
+
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+
+    if (record_count) {
+        report();
+    }
+
+    free(records);
+    return retval;
+}
@@ -0,0 +1,712 @@
+/**********************************************************************
+NAME
+
+    wc - word, line, and byte or character count
+
+SYNOPSIS
+
+    wc [-c|-m] [-lw] [file...]
+
+DESCRIPTION
+
+    The wc utility shall read one or more input files and, by default, write
+    the number of <newline> characters, words, and bytes contained in each
+    input file to the standard output.
+
+    The utility also shall write a total count for all named files, if more
+    than one input file is specified.
+
+    The wc utility shall consider a word to be a non-zero-length string of
+    characters delimited by white space.
+
+OPTIONS
+
+    The wc utility shall conform to XBD Utility Syntax Guidelines.
+
+    The following options shall be supported:
+
+    -c
+        Write to the standard output the number of bytes in each input file.
+    -l
+        Write to the standard output the number of <newline> characters in
+        each input file.
+    -m
+        Write to the standard output the number of characters in each input
+        file.
+    -w
+        Write to the standard output the number of words in each input file.
+
+    When any option is specified, wc shall report only the information
+    requested by the specified options.
+
+OPERANDS
+
+    The following operand shall be supported:
+
+    file
+        A pathname of an input file. If no file operands are specified, the
+        standard input shall be used.
+
+STDIN
+
+    The standard input shall be used if no file operands are specified, and
+    shall be used if a file operand is '-'.
+
+INPUT FILES
+
+    The input files may be of any type.
+
+ENVIRONMENT VARIABLES
+
+    The following environment variables shall affect the execution of wc:
+
+    LC_CTYPE
+        Determine the locale for the interpretation of sequences of bytes of
+        text data as characters, and which characters are white space.
+
+    As posixy doesn't set the locale, it runs in the POSIX locale, where
+    every byte is a character, and the white space characters are <space>,
+    <tab>, <newline>, <vertical-tab>, <form-feed> and <carriage-return>.
+
+    As an extension, POSIXY_WC_THREADS sets how many threads count a large
+    regular file, which defaults to the number of CPUs online.
+
+ASYNCHRONOUS EVENTS
+
+    Default.
+
+STDOUT
+
+    By default, the standard output shall contain an entry for each input
+    file of the form:
+
+        "%d %d %d %s\n", <newlines>, <words>, <bytes>, <file>
+
+    If any options are specified, only the requested counts are written, in
+    the order of lines, words, and bytes or characters. When no file operand
+    is specified, the name shall be omitted. If more than one file operand
+    is specified, a line with the total of each count is written, with the
+    name "total".
+
+STDERR
+
+    The standard error shall be used only for diagnostic messages.
+
+OUTPUT FILES
+
+    None.
+
+EXTENDED DESCRIPTION
+
+    None.
+
+EXIT STATUS
+
+    The following exit values shall be returned:
+
+     0
+        Successful completion.
+    >0
+        An error occurred.
+
+CONSEQUENCES OF ERRORS
+
+    Default.
+
+ **********************************************************************
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "iobuf.h"
+
+#define PROGRAM     "wc"
+
+/* Most threads to count a file with */
+#define WC_THREADS      64
+
+/* Smallest part of a file worth a thread of its own */
+#define CHUNK_MIN       (16 * 1024 * 1024)
+
+/* Regular files from this size on are mapped rather than read */
+#define MMAP_MIN        (1024 * 1024)
+
+/* Stack size for the counting threads, which use next to none */
+#define THREAD_STACK    (64 * 1024)
+
+/* The vector loops add up matches in bytes, which this many blocks fill */
+#define BYTE_LIMIT      255
+
+struct counts {
+    uint64_t lines;
+    uint64_t words;
+    uint64_t bytes;
+};
+
+/* What to count, and what to print */
+static int count_lines;
+static int count_words;
+static int count_bytes;
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s [-c|-m] [-lw] [file...]\n", PROGRAM);
+}
+
+static inline int is_space(unsigned char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/*
+ * The counting kernel. A word is counted where it starts, at a byte that
+ * isn't white space after one that is, so the only state carried from one
+ * buffer to the next is whether the last byte was white space. Each kernel
+ * counts as much of the buffer as it can, and returns how far it got.
+ */
+static inline __attribute__((always_inline))
+size_t count_scalar(const unsigned char *p, size_t n, struct counts *c,
+                    int *space_before, const int words)
+{
+    int space = *space_before;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        c->lines += p[i] == '\n';
+        if (words) {
+            c->words += space && !is_space(p[i]);
+            space = is_space(p[i]);
+        }
+    }
+
+    *space_before = space;
+    return n;
+}
+
+#ifdef __SSE2__
+/* Sum of the bytes in an accumulator */
+static inline __attribute__((always_inline))
+uint64_t sum_sse2(__m128i acc)
+{
+    __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+
+    return (uint32_t)_mm_cvtsi128_si32(sums) +
+           (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+}
+
+/*
+ * 16 bytes at a time. The comparisons give 0xff for a match, so subtracting
+ * them counts matches in each byte, which are added up every BYTE_LIMIT
+ * blocks. The word starts are the bytes that aren't white space, where the
+ * byte before is, from the white space mask shifted along by one byte.
+ */
+static inline __attribute__((always_inline))
+size_t count_sse2(const unsigned char *p, size_t n, struct counts *c,
+                  int *space_before, const int words)
+{
+    const __m128i newlines = _mm_set1_epi8('\n');
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i tabs = _mm_set1_epi8('\t');
+    const __m128i controls = _mm_set1_epi8('\r' - '\t');
+    __m128i prev = _mm_set1_epi8(*space_before ? -1 : 0);
+    __m128i line_acc;
+    __m128i word_acc;
+    __m128i v;
+    __m128i x;
+    __m128i space;
+    size_t i = 0;
+    size_t end;
+
+    while (n - i >= 16) {
+        end = n - i > BYTE_LIMIT * 16 ? i + BYTE_LIMIT * 16 : n;
+        line_acc = _mm_setzero_si128();
+        word_acc = _mm_setzero_si128();
+
+        for (; end - i >= 16; i += 16) {
+            v = _mm_loadu_si128((const __m128i *)(p + i));
+            line_acc = _mm_sub_epi8(line_acc, _mm_cmpeq_epi8(v, newlines));
+
+            if (words) {
+                x = _mm_sub_epi8(v, tabs);
+                space = _mm_or_si128(_mm_cmpeq_epi8(v, spaces),
+                            _mm_cmpeq_epi8(_mm_min_epu8(x, controls), x));
+                word_acc = _mm_sub_epi8(word_acc, _mm_andnot_si128(space,
+                               _mm_or_si128(_mm_slli_si128(space, 1),
+                                            _mm_srli_si128(prev, 15))));
+                prev = space;
+            }
+        }
+
+        c->lines += sum_sse2(line_acc);
+        if (words) {
+            c->words += sum_sse2(word_acc);
+        }
+    }
+
+    if (words) {
+        *space_before = _mm_movemask_epi8(prev) >> 15;
+    }
+    return i;
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define WC_AVX2
+
+static inline __attribute__((always_inline, target("avx2")))
+uint64_t sum_avx2(__m256i acc)
+{
+    __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums),
+                                 _mm256_extracti128_si256(sums, 1));
+
+    return (uint32_t)_mm_cvtsi128_si32(half) +
+           (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+}
+
+/*
+ * As count_sse2, 32 bytes at a time. The shift by one byte crosses the two
+ * lanes, so the byte shifted in to each lane is taken from a permutation
+ * of the previous mask and this one.
+ */
+static inline __attribute__((always_inline, target("avx2")))
+size_t count_avx2(const unsigned char *p, size_t n, struct counts *c,
+                  int *space_before, const int words)
+{
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    const __m256i tabs = _mm256_set1_epi8('\t');
+    const __m256i controls = _mm256_set1_epi8('\r' - '\t');
+    __m256i prev = _mm256_set1_epi8(*space_before ? -1 : 0);
+    __m256i line_acc;
+    __m256i word_acc;
+    __m256i v;
+    __m256i x;
+    __m256i space;
+    __m256i before;
+    size_t i = 0;
+    size_t end;
+
+    while (n - i >= 32) {
+        end = n - i > BYTE_LIMIT * 32 ? i + BYTE_LIMIT * 32 : n;
+        line_acc = _mm256_setzero_si256();
+        word_acc = _mm256_setzero_si256();
+
+        for (; end - i >= 32; i += 32) {
+            v = _mm256_loadu_si256((const __m256i *)(p + i));
+            line_acc = _mm256_sub_epi8(line_acc,
+                                       _mm256_cmpeq_epi8(v, newlines));
+
+            if (words) {
+                x = _mm256_sub_epi8(v, tabs);
+                space = _mm256_or_si256(_mm256_cmpeq_epi8(v, spaces),
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(x, controls),
+                                              x));
+                before = _mm256_alignr_epi8(space,
+                             _mm256_permute2x128_si256(prev, space, 0x21),
+                             15);
+                word_acc = _mm256_sub_epi8(word_acc,
+                                           _mm256_andnot_si256(space, before));
+                prev = space;
+            }
+        }
+
+        c->lines += sum_avx2(line_acc);
+        if (words) {
+            c->words += sum_avx2(word_acc);
+        }
+    }
+
+    if (words) {
+        *space_before = (uint32_t)_mm256_movemask_epi8(prev) >> 31;
+    }
+    return i;
+}
+
+/* Instances of the kernels for lines only, and for lines and words */
+__attribute__((target("avx2")))
+static size_t lines_avx2(const unsigned char *p, size_t n, struct counts *c,
+                         int *space_before)
+{
+    return count_avx2(p, n, c, space_before, 0);
+}
+
+__attribute__((target("avx2")))
+static size_t words_avx2(const unsigned char *p, size_t n, struct counts *c,
+                         int *space_before)
+{
+    return count_avx2(p, n, c, space_before, 1);
+}
+#endif
+
+static size_t lines_default(const unsigned char *p, size_t n,
+                            struct counts *c, int *space_before)
+{
+#ifdef __SSE2__
+    return count_sse2(p, n, c, space_before, 0);
+#else
+    return count_scalar(p, n, c, space_before, 0);
+#endif
+}
+
+static size_t words_default(const unsigned char *p, size_t n,
+                            struct counts *c, int *space_before)
+{
+#ifdef __SSE2__
+    return count_sse2(p, n, c, space_before, 1);
+#else
+    return count_scalar(p, n, c, space_before, 1);
+#endif
+}
+
+/* Count a buffer with the widest kernel the CPU has, then the rest */
+static void count_buffer(const unsigned char *p, size_t n, struct counts *c,
+                         int *space_before)
+{
+    size_t done = 0;
+#ifdef WC_AVX2
+    static int avx2 = -1;
+
+    if (avx2 == -1) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2");
+    }
+    if (avx2) {
+        done = count_words ? words_avx2(p, n, c, space_before) :
+                             lines_avx2(p, n, c, space_before);
+    }
+#endif
+
+    done += count_words ? words_default(p + done, n - done, c, space_before) :
+                          lines_default(p + done, n - done, c, space_before);
+
+    if (count_words) {
+        count_scalar(p + done, n - done, c, space_before, 1);
+    } else {
+        count_scalar(p + done, n - done, c, space_before, 0);
+    }
+
+    c->bytes += n;
+}
+
+/*
+ * A part of a mapped file, counted by a thread of its own as if it started
+ * after white space. Where a word runs across the boundary with the part
+ * before, it has been counted twice, once in each.
+ */
+struct chunk {
+    const unsigned char *data;
+    size_t len;
+    struct counts counts;
+    int space_after;                /* The last byte is white space */
+    pthread_t thread;
+    int started;
+};
+
+static void count_chunk(struct chunk *chunk)
+{
+    chunk->space_after = 1;
+    count_buffer(chunk->data, chunk->len, &chunk->counts, &chunk->space_after);
+}
+
+static void *chunk_thread(void *arg)
+{
+    count_chunk(arg);
+    return NULL;
+}
+
+/* Number of threads to count size bytes with */
+static int thread_count(size_t size)
+{
+    char *env = getenv("POSIXY_WC_THREADS");
+    long nthreads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (nthreads > WC_THREADS) {
+        nthreads = WC_THREADS;
+    }
+    if ((size_t)nthreads > size / CHUNK_MIN) {
+        nthreads = size / CHUNK_MIN;
+    }
+
+    return nthreads < 1 ? 1 : nthreads;
+}
+
+/*
+ * Count a regular file from the current offset to size by mapping it, and
+ * splitting it between threads if it is large. The word state is stitched
+ * together at each boundary afterwards. Returns -1 if the file couldn't be
+ * mapped, to fall back to reading it, or 0 with the offset left at size.
+ */
+static int count_mapped(int fd, off_t size, struct counts *c,
+                        int *space_before)
+{
+    struct chunk chunks[WC_THREADS];
+    size_t page = sysconf(_SC_PAGE_SIZE);
+    const unsigned char *data;
+    pthread_attr_t attr;
+    sigset_t all;
+    sigset_t old;
+    off_t offset;
+    off_t map_start;
+    size_t len;
+    size_t part;
+    int nthreads;
+    int i;
+
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == -1 || offset >= size) {
+        return -1;
+    }
+
+    map_start = offset - offset % page;
+    data = mmap(NULL, size - map_start, PROT_READ, MAP_PRIVATE, fd, map_start);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *)data, size - map_start, MADV_SEQUENTIAL);
+
+    len = size - offset;
+    nthreads = thread_count(len);
+    part = (len / nthreads + page - 1) / page * page;
+
+    memset(chunks, 0, sizeof(chunks));
+    for (i = 0; i < nthreads; i++) {
+        chunks[i].data = data + (offset - map_start) + i * part;
+        chunks[i].len = i < nthreads - 1 ? part : len - i * part;
+    }
+
+    /* The threads only count, and signals are left to main */
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 1; i < nthreads; i++) {
+        chunks[i].started = pthread_create(&chunks[i].thread, &attr,
+                                           chunk_thread, &chunks[i]) == 0;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+
+    /* The first part continues from the state before, unlike the others */
+    chunks[0].space_after = *space_before;
+    count_buffer(chunks[0].data, chunks[0].len, &chunks[0].counts,
+                 &chunks[0].space_after);
+
+    for (i = 1; i < nthreads; i++) {
+        if (chunks[i].started) {
+            pthread_join(chunks[i].thread, NULL);
+        } else {
+            count_chunk(&chunks[i]);
+        }
+
+        /* A word carried over from the part before was counted in both */
+        if (!chunks[i - 1].space_after && chunks[i].len &&
+            !is_space(chunks[i].data[0])) {
+            chunks[i].counts.words--;
+        }
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        c->lines += chunks[i].counts.lines;
+        c->words += chunks[i].counts.words;
+        c->bytes += chunks[i].counts.bytes;
+    }
+    *space_before = chunks[nthreads - 1].space_after;
+
+    munmap((void *)data, size - map_start);
+    lseek(fd, size, SEEK_SET);
+    return 0;
+}
+
+/* Count what is left of fd, returns -1 on a read error with errno set */
+static int count_fd(int fd, struct counts *c)
+{
+    struct iobuf buf = { NULL, 0, 0 };
+    int space_before = 1;
+    struct stat st;
+    off_t offset;
+    ssize_t got;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        /* The size alone is enough for the byte count */
+        if (!count_lines && !count_words) {
+            offset = lseek(fd, 0, SEEK_CUR);
+            if (offset != -1 && st.st_size > 0) {
+                c->bytes += offset < st.st_size ? st.st_size - offset : 0;
+                lseek(fd, st.st_size, SEEK_SET);
+            }
+        } else if (st.st_size >= MMAP_MIN) {
+            count_mapped(fd, st.st_size, c, &space_before);
+        }
+    }
+
+    /* Anything else, and anything appended to a regular file since */
+    for (;;) {
+        if (buf.data == NULL &&
+            iobuf_reserve(&buf, iobuf_size_hint(fd, -1)) == -1) {
+            return -1;
+        }
+
+        got = read(fd, buf.data, buf.size);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        } else if (got == -1) {
+            iobuf_free(&buf);
+            return -1;
+        } else if (got == 0) {
+            break;
+        }
+
+        if (count_lines || count_words) {
+            count_buffer((const unsigned char *)buf.data, got, c,
+                         &space_before);
+        } else {
+            c->bytes += got;
+        }
+
+        if ((size_t)got == buf.size) {
+            iobuf_grow(&buf);
+        }
+    }
+
+    iobuf_free(&buf);
+    return 0;
+}
+
+static void print_counts(const struct counts *c, const char *name)
+{
+    const char *separator = "";
+
+    if (count_lines) {
+        printf("%llu", (unsigned long long)c->lines);
+        separator = " ";
+    }
+    if (count_words) {
+        printf("%s%llu", separator, (unsigned long long)c->words);
+        separator = " ";
+    }
+    if (count_bytes) {
+        printf("%s%llu", separator, (unsigned long long)c->bytes);
+    }
+
+    if (name) {
+        printf(" %s", name);
+    }
+    printf("\n");
+}
+
+int posix_wc(int argc, char **argv)
+{
+    struct counts total = { 0, 0, 0 };
+    struct counts c;
+    int retval = 0;
+    int bytes = 0;
+    int chars = 0;
+    int opt;
+    int fd;
+    int i;
+
+    count_lines = count_words = count_bytes = 0;
+
+    while ((opt = getopt(argc, argv, "clmw")) != -1) {
+        switch (opt) {
+        case 'c':
+            count_bytes = 1;
+            bytes = 1;
+            break;
+
+        /* In the POSIX locale, characters are bytes */
+        case 'm':
+            count_bytes = 1;
+            chars = 1;
+            break;
+
+        case 'l':
+            count_lines = 1;
+            break;
+
+        case 'w':
+            count_words = 1;
+            break;
+
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    /* -c and -m are mutually exclusive */
+    if (bytes && chars) {
+        usage();
+        return 1;
+    }
+
+    if (!count_lines && !count_words && !count_bytes) {
+        count_lines = count_words = count_bytes = 1;
+    }
+
+    if (optind == argc) {
+        memset(&c, 0, sizeof(c));
+        if (count_fd(STDIN_FILENO, &c) == -1) {
+            fprintf(stderr, "%s: stdin: %s\n", PROGRAM, strerror(errno));
+            retval = 1;
+        }
+        print_counts(&c, NULL);
+    }
+
+    for (i = optind; i < argc; i++) {
+        memset(&c, 0, sizeof(c));
+
+        if (strcmp(argv[i], "-") == 0) {
+            fd = STDIN_FILENO;
+        } else {
+            fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                fprintf(stderr, "%s: %s: %s\n", PROGRAM, argv[i],
+                        strerror(errno));
+                retval = 1;
+                continue;
+            }
+        }
+
+        if (count_fd(fd, &c) == -1) {
+            fprintf(stderr, "%s: %s: %s\n", PROGRAM, argv[i],
+                    strerror(errno));
+            retval = 1;
+        }
+
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+
+        print_counts(&c, argv[i]);
+        total.lines += c.lines;
+        total.words += c.words;
+        total.bytes += c.bytes;
+    }
+
+    if (argc - optind > 1) {
+        print_counts(&total, "total");
+    }
+
+    if (fflush(stdout) == EOF || ferror(stdout)) {
+        fprintf(stderr, "%s: stdout: %s\n", PROGRAM, strerror(errno));
+        retval = 1;
+    }
+
+    return retval;
+}
@@ -0,0 +1,229 @@
+/*
+ * Buffer sizing policy for the cat and tee copy loops
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "iobuf.h"
+
+/* Buffers of at least this size are backed by huge pages where possible */
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+int iobuf_parse_size(const char *value, unsigned long long *size)
+{
+    char *endptr;
+    unsigned long long parsed;
+
+    if (value == NULL || *value == '\0') {
+        return -1;
+    }
+
+    errno = 0;
+    parsed = strtoull(value, &endptr, 10);
+    switch (*endptr) {
+    case 'G': case 'g':
+        parsed *= 1024;
+        /* fall through */
+    case 'M': case 'm':
+        parsed *= 1024;
+        /* fall through */
+    case 'K': case 'k':
+        parsed *= 1024;
+        endptr++;
+        break;
+    }
+
+    if (errno != 0 || *endptr != '\0') {
+        return -1;
+    }
+
+    *size = parsed;
+    return 0;
+}
+
+size_t iobuf_max(void)
+{
+    static size_t max;
+    unsigned long long parsed;
+
+    if (max != 0) {
+        return max;
+    }
+
+    max = IOBUF_DEFAULT_MAX;
+
+    /* Ignore invalid values, and keep the buffer within sane limits */
+    if (iobuf_parse_size(getenv("POSIXY_IOBUF_MAX"), &parsed) == 0 &&
+        parsed >= 512 && parsed <= (1ULL << 30)) {
+        max = parsed;
+    }
+
+    return max;
+}
+
+size_t iobuf_size_hint(int in_fd, int out_fd)
+{
+    struct stat st;
+    size_t page = sysconf(_SC_PAGE_SIZE);
+    size_t size = IOBUF_MIN;
+    size_t max = iobuf_max();
+#ifdef F_GETPIPE_SZ
+    int pipe_size;
+#endif
+
+    if (fstat(out_fd, &st) == 0) {
+        if ((size_t)st.st_blksize > size) {
+            size = st.st_blksize;
+        }
+
+#ifdef F_GETPIPE_SZ
+        /* Let a single write fill the pipe */
+        if (S_ISFIFO(st.st_mode)) {
+            pipe_size = fcntl(out_fd, F_GETPIPE_SZ);
+            if (pipe_size > 0 && (size_t)pipe_size > size) {
+                size = pipe_size;
+            }
+        }
+#endif
+    }
+
+    if (fstat(in_fd, &st) == 0) {
+        if ((size_t)st.st_blksize > size) {
+            size = st.st_blksize;
+        }
+
+        /*
+         * Don't allocate more than a small regular file needs. The extra
+         * byte lets the first read return the whole file.
+         */
+        if (S_ISREG(st.st_mode) && st.st_size > 0 &&
+            (size_t)st.st_size + 1 < size) {
+            size = st.st_size + 1;
+        }
+    }
+
+    /* Round up to whole pages */
+    size = (size + page - 1) / page * page;
+
+    if (size > max) {
+        size = max;
+    }
+
+    return size;
+}
+
+/* Allocate a buffer, preferring huge pages for large sizes */
+static char *iobuf_map(size_t size, int *mmapped)
+{
+    char *data;
+
+#ifdef MAP_HUGETLB
+    if (size % HUGE_PAGE_SIZE == 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            *mmapped = 1;
+            return data;
+        }
+    }
+#endif
+
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+        /* No reserved huge pages, but transparent huge pages may do */
+        if (size >= HUGE_PAGE_SIZE) {
+            madvise(data, size, MADV_HUGEPAGE);
+        }
+#endif
+        *mmapped = 1;
+        return data;
+    }
+
+    /* mmap failed, but try to malloc instead */
+    *mmapped = 0;
+    return malloc(size);
+}
+
+int iobuf_reserve(struct iobuf *buf, size_t size)
+{
+    size_t max = iobuf_max();
+
+    if (size > max) {
+        size = max;
+    }
+
+    if (buf->data != NULL && buf->size >= size) {
+        return 0;
+    }
+
+    return iobuf_alloc(buf, size);
+}
+
+int iobuf_alloc(struct iobuf *buf, size_t size)
+{
+    char *data;
+    int mmapped;
+
+    /* Huge pages can only be used for whole huge pages */
+    if (size >= HUGE_PAGE_SIZE) {
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    data = iobuf_map(size, &mmapped);
+    if (data == NULL) {
+        return -1;
+    }
+
+    iobuf_free(buf);
+    buf->data = data;
+    buf->size = size;
+    buf->mmapped = mmapped;
+
+    return 0;
+}
+
+void iobuf_grow(struct iobuf *buf)
+{
+    if (buf->size < iobuf_max()) {
+        /* On failure, keep going with the current buffer */
+        iobuf_reserve(buf, buf->size * 2);
+    }
+}
+
+void iobuf_free(struct iobuf *buf)
+{
+    if (buf->data == NULL) {
+        return;
+    }
+
+    if (buf->mmapped) {
+        munmap(buf->data, buf->size);
+    } else {
+        free(buf->data);
+    }
+
+    buf->data = NULL;
+    buf->size = 0;
+    buf->mmapped = 0;
+}
+
+void iobuf_tune_pipe(int fd, size_t size)
+{
+#ifdef F_SETPIPE_SZ
+    int pipe_size;
+
+    pipe_size = fcntl(fd, F_GETPIPE_SZ);
+    if (pipe_size > 0 && (size_t)pipe_size < size) {
+        /* Unprivileged users are limited by /proc/sys/fs/pipe-max-size */
+        fcntl(fd, F_SETPIPE_SZ, (int)size);
+    }
+#endif
+}
@@ -0,0 +1,64 @@
+#ifndef POSIXY_IOBUF_H
+#define POSIXY_IOBUF_H
+
+#include <stddef.h>
+
+/*
+ * I/O buffer shared by the copy loops in cat and tee
+ *
+ * The buffer size is chosen from the block sizes of the input and output,
+ * the size of the input file and the output type. It starts at the chosen
+ * size, and grows up to a ceiling while reads keep filling it completely.
+ * The ceiling defaults to IOBUF_DEFAULT_MAX and can be set with the
+ * POSIXY_IOBUF_MAX environment variable, in bytes with an optional K, M or
+ * G suffix.
+ */
+
+/* Preferred minimum buffer size, unless the input is smaller */
+#define IOBUF_MIN           (128 * 1024)
+
+/* Default ceiling for the buffer size */
+#define IOBUF_DEFAULT_MAX   (1024 * 1024)
+
+struct iobuf {
+    char *data;
+    size_t size;
+    int mmapped;
+};
+
+/* Get the ceiling for the buffer size */
+size_t iobuf_max(void);
+
+/*
+ * Parse a size in bytes with an optional K, M or G suffix, as used by the
+ * environment variables for buffer sizes. Returns -1 if it is not valid.
+ */
+int iobuf_parse_size(const char *value, unsigned long long *size);
+
+/* Pick a buffer size for copying from in_fd to out_fd */
+size_t iobuf_size_hint(int in_fd, int out_fd);
+
+/*
+ * Make sure that the buffer holds at least size bytes, clamped to the
+ * ceiling. The contents are not preserved. Returns 0 on success, -1 on
+ * failure with errno set, in which case the old buffer is still valid.
+ */
+int iobuf_reserve(struct iobuf *buf, size_t size);
+
+/*
+ * Allocate a buffer of exactly size bytes, or more if rounded up to huge
+ * pages, without applying the ceiling. This is for buffers that are not
+ * sized by this policy, such as the ring buffer in tee.
+ */
+int iobuf_alloc(struct iobuf *buf, size_t size);
+
+/* Double the buffer size, if it is below the ceiling */
+void iobuf_grow(struct iobuf *buf);
+
+/* Release the buffer */
+void iobuf_free(struct iobuf *buf);
+
+/* Raise the capacity of a pipe to at least size bytes, where permitted */
+void iobuf_tune_pipe(int fd, size_t size);
+
+#endif /* POSIXY_IOBUF_H */
@@ -1,58 +1,131 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
-#include <dlfcn.h>
+#include <unistd.h>
+#include <signal.h>
 
-typedef int (*handler_function)(int, char**);
+#include "posixy.h"
+#include "trace.h"
+#include "handlers.h"
+
+#define HANDLER_COUNT   (sizeof(handler_table) / sizeof(handler_table[0]))
+
+static int handler_compare(const void *key, const void *entry)
+{
+    return strcmp(key, ((const struct handler *)entry)->name);
+}
 
 /*
- * Main function which dispatches the execution to different handlers
- * depending on the value of argv[0]
+ * Lookup the handler for the given command in the generated dispatch table.
+ * The table is sorted at build time, so a binary search is sufficient.
  */
-int main(int argc, char **argv)
+static handler_function find_handler(const char *command)
+{
+    const struct handler *entry;
+
+    entry = bsearch(command, handler_table, HANDLER_COUNT,
+                    sizeof(handler_table[0]), handler_compare);
+
+    return entry ? entry->func : NULL;
+}
+
+/*
+ * Reset the process-global state that handlers may leave behind, so that the
+ * next handler run in the same process sees what a freshly exec'd posixy
+ * would see. The handlers initialize their own globals on entry.
+ */
+void posixy_reset(void)
+{
+    static const int signals[] = { SIGALRM, SIGINT, SIGHUP, SIGPIPE, SIGTERM };
+    unsigned int i;
+
+    /* Rescan from the first argument, glibc also resets its internal state */
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optind = 1;
+#endif
+    opterr = 1;
+
+    alarm(0);
+    for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        signal(signals[i], SIG_DFL);
+    }
+
+    clearerr(stdin);
+    clearerr(stdout);
+    clearerr(stderr);
+
+    /* Undo setbuf(stdout, NULL) done by some of the handlers */
+    setvbuf(stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, BUFSIZ);
+}
+
+/* Get the basename of the command */
+static char *command_name(char *path)
 {
-    void *command_interp;
-    int retval = 0;
     char *command;
-    char command_func[64];
-    handler_function handler;
-    int offset = 0;
 
-    /* Get the basename of the command */
-    command = strrchr(argv[0], '/');
+    command = strrchr(path, '/');
     if (command == NULL) {
-        command = argv[0];
+        command = path;
     } else {
         /* Skip over the / */
         command++;
     }
 
+    return command;
+}
+
+/*
+ * Dispatch the execution to different handlers depending on the value of
+ * argv[0]
+ */
+int posixy_dispatch(int argc, char **argv)
+{
+    int retval = 0;
+    char *command;
+    handler_function handler;
+    int offset = 0;
+
+    command = command_name(argv[0]);
+
     /* If the command matches PROGNAME, then use argv[1] instead */
     if (strcmp(command, PROGNAME) == 0) {
+        if (argc < 2) {
+            fprintf(stderr, "Usage: %s command [args...]\n", PROGNAME);
+            return 1;
+        }
+
         command = argv[1];
         offset = 1;
     }
 
-    /* Load the current executable to lookup the symbol */
-    command_interp = dlopen(NULL, RTLD_NOW);
-    if (command_interp == NULL) {
-        fprintf(stderr, "Unable to load interpreter: %s\n", strerror(errno));
-        return 1;
-    }
-
-    /* Generate the function name for the executable */
-    snprintf(command_func, sizeof(command_func), "posix_%s", command);
-
     /* Lookup the function */
-    handler = dlsym(command_interp, command_func);
+    handler = find_handler(command);
 
     if (!handler) {
         fprintf(stderr, "Unrecognized command %s\n", command);
         retval = 1;
     } else {
+        trace_dispatch(command);
         retval = (*handler)(argc - offset, argv + offset);
+        trace_return(retval);
     }
 
     return retval;
 }
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(command_name(argv[0]), PROGNAME) == 0) {
+        /* posixy --batch runs many commands, each traced as it returns */
+        if (strcmp(argv[1], "--batch") == 0) {
+            trace_init(0);
+            return posixy_batch(argc - 1, argv + 1);
+        }
+    }
+
+    /* A single command, traced at exit */
+    trace_init(1);
+    return posixy_dispatch(argc, argv);
+}
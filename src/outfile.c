@@ -0,0 +1,557 @@
+/*
+ * File output for tee, see outfile.h
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "outfile.h"
+
+/* Size of the staging buffer for O_DIRECT */
+#define STAGE_SIZE          (1024 * 1024)
+
+/* Bumped from the SIGHUP handler, each file reopens when it next sees it */
+static volatile sig_atomic_t reopen_requests;
+
+/* Write all of buf to the file, returns -1 on error */
+static int write_all(struct outfile *out, const char *buf, size_t len)
+{
+    ssize_t bytes_written;
+
+    while (len > 0) {
+        bytes_written = stats_write(out->stats, out->fd, buf, len);
+        if (bytes_written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        buf += bytes_written;
+        len -= bytes_written;
+    }
+
+    return 0;
+}
+
+/* Turn O_DIRECT on or off for the file */
+static int set_direct(struct outfile *out, int on)
+{
+#ifdef O_DIRECT
+    int flags = fcntl(out->fd, F_GETFL);
+
+    if (flags == -1) {
+        return -1;
+    }
+
+    flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return fcntl(out->fd, F_SETFL, flags);
+#else
+    (void)out;
+    (void)on;
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+/* Allocate space ahead of a write of len bytes */
+static void prealloc(struct outfile *out, size_t len)
+{
+#ifdef HAVE_FALLOCATE
+    unsigned long long extent = out->options->prealloc;
+    unsigned long long end = out->offset + len;
+    unsigned long long size;
+
+    if (end <= out->allocated) {
+        return;
+    }
+
+    size = (end - out->allocated + extent - 1) / extent * extent;
+    if (fallocate(out->fd, FALLOC_FL_KEEP_SIZE, out->allocated, size) == 0) {
+        out->allocated += size;
+    } else {
+        out->features &= ~OUTFILE_PREALLOC;
+    }
+#else
+    (void)len;
+    out->features &= ~OUTFILE_PREALLOC;
+#endif
+}
+
+/*
+ * Start writeback of the window just written, and wait for the one before
+ * it, dropping it from the page cache as it is no longer needed
+ */
+static int write_behind(struct outfile *out)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+    if (out->offset - out->flushed < out->options->writebehind) {
+        return 0;
+    }
+
+    if (sync_file_range(out->fd, out->flushed, out->offset - out->flushed,
+                        SYNC_FILE_RANGE_WRITE) == -1) {
+        goto fail;
+    }
+
+    if (out->flushed > out->synced) {
+        if (sync_file_range(out->fd, out->synced, out->flushed - out->synced,
+                            SYNC_FILE_RANGE_WAIT_BEFORE |
+                            SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER) == -1) {
+            goto fail;
+        }
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(out->fd, out->synced, out->flushed - out->synced,
+                      POSIX_FADV_DONTNEED);
+#endif
+    }
+
+    out->synced = out->flushed;
+    out->flushed = out->offset;
+    return 0;
+
+fail:
+    /* Only write errors are worth reporting */
+    if (errno == EIO || errno == ENOSPC) {
+        return -1;
+    }
+#endif
+    out->features &= ~OUTFILE_WRITEBEHIND;
+    return 0;
+}
+
+/* Write len bytes of the staging buffer, and keep whatever is left over */
+static int stage_write(struct outfile *out, size_t len)
+{
+    if (out->features & OUTFILE_PREALLOC) {
+        prealloc(out, len);
+    }
+
+    if (write_all(out, out->stage.data, len) == -1) {
+        return -1;
+    }
+
+    out->offset += len;
+    out->staged -= len;
+    memmove(out->stage.data, out->stage.data + len, out->staged);
+    return 0;
+}
+
+/*
+ * Write out the staging buffer with O_DIRECT, as far as it is aligned. An
+ * unaligned start of the file is written through the page cache first, and
+ * on close the same goes for the tail.
+ */
+static int stage_flush(struct outfile *out, int final)
+{
+    size_t head = out->offset % out->align;
+    size_t len;
+
+    if (head != 0) {
+        head = out->align - head;
+        if (head > out->staged) {
+            head = out->staged;
+        }
+
+        if (stage_write(out, head) == -1) {
+            return -1;
+        }
+        if (out->offset % out->align == 0 && set_direct(out, 1) == -1) {
+            return -1;
+        }
+    }
+
+    len = out->staged / out->align * out->align;
+    if (len > 0 && stage_write(out, len) == -1) {
+        return -1;
+    }
+
+    if (final && out->staged > 0) {
+        if (out->offset % out->align == 0 && set_direct(out, 0) == -1) {
+            return -1;
+        }
+        return stage_write(out, out->staged);
+    }
+
+    return 0;
+}
+
+static void setup_direct(struct outfile *out, const struct stat *st)
+{
+    size_t page = sysconf(_SC_PAGE_SIZE);
+
+    out->align = page;
+    if ((size_t)st->st_blksize > page && st->st_blksize % page == 0) {
+        out->align = st->st_blksize;
+    }
+
+    out->stage.data = NULL;
+    if (iobuf_alloc(&out->stage, (STAGE_SIZE + out->align - 1) /
+                    out->align * out->align) == -1) {
+        return;
+    }
+
+    /* O_DIRECT needs aligned memory too, which malloc doesn't promise */
+    if ((uintptr_t)out->stage.data % out->align != 0) {
+        iobuf_free(&out->stage);
+        return;
+    }
+
+    /*
+     * Some file systems, such as tmpfs, don't support O_DIRECT. An
+     * unaligned start is written through the page cache before using it.
+     */
+    if (set_direct(out, 1) == -1 ||
+        (out->offset % out->align != 0 && set_direct(out, 0) == -1)) {
+        iobuf_free(&out->stage);
+        return;
+    }
+
+    out->features |= OUTFILE_DIRECT;
+}
+
+/* Start writing to a new descriptor for the file, at the given offset */
+static int attach(struct outfile *out, int fd, unsigned long long offset)
+{
+    out->fd = fd;
+    out->offset = offset;
+    out->allocated = offset;
+    out->flushed = offset;
+    out->synced = offset;
+
+    if ((out->features & OUTFILE_DIRECT) && offset % out->align == 0) {
+        return set_direct(out, 1);
+    }
+
+    return 0;
+}
+
+/*
+ * Write out anything still staged and give back the preallocated space
+ * past the end, ready to close the descriptor. Returns -1 with errno set
+ * if either fails.
+ */
+static int finish(struct outfile *out)
+{
+    struct stat st;
+
+    if ((out->features & OUTFILE_DIRECT) && stage_flush(out, 1) == -1) {
+        return -1;
+    }
+
+    if (out->allocated > out->offset && fstat(out->fd, &st) == 0 &&
+        ftruncate(out->fd, st.st_size) == -1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the next segment ready ahead of the switch, as an unnamed file in the
+ * same directory, with its space allocated
+ */
+static void prepare_next(struct outfile *out)
+{
+#ifdef O_TMPFILE
+    char *slash = strrchr(out->name, '/');
+    char *dir;
+
+    if (out->next_fd != -1) {
+        return;
+    }
+
+    if (slash == NULL) {
+        dir = strdup(".");
+    } else {
+        dir = strndup(out->name, slash - out->name + 1);
+    }
+    if (dir == NULL) {
+        return;
+    }
+
+    out->next_fd = open(dir, O_TMPFILE | O_WRONLY,
+                        S_IRWXU | S_IRWXG | S_IRWXO);
+    free(dir);
+
+#ifdef HAVE_FALLOCATE
+    if (out->next_fd != -1 &&
+        fallocate(out->next_fd, FALLOC_FL_KEEP_SIZE, 0,
+                  out->options->rotate) == 0) {
+        out->next_allocated = out->options->rotate;
+    }
+#endif
+#else
+    (void)out;
+#endif
+}
+
+/* Find the first free segment number after the file's existing segments */
+static void find_segment(struct outfile *out)
+{
+    struct stat st;
+
+    for (out->segment = 1; ; out->segment++) {
+        sprintf(out->rotated, "%s.%lu", out->name, out->segment);
+        if (stat(out->rotated, &st) == -1) {
+            break;
+        }
+    }
+}
+
+/*
+ * Move the file aside as the next numbered segment, and carry on in a new
+ * file under the original name
+ */
+static int rotate(struct outfile *out)
+{
+    char proc_path[64];
+    int fd = -1;
+
+    if (finish(out) == -1) {
+        return -1;
+    }
+
+    sprintf(out->rotated, "%s.%lu", out->name, out->segment);
+    if (rename(out->name, out->rotated) == -1) {
+        return -1;
+    }
+    out->segment++;
+
+    /* Give the prepared file its name, or fall back to creating one */
+    if (out->next_fd != -1) {
+        snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d",
+                 out->next_fd);
+        if (linkat(AT_FDCWD, proc_path, AT_FDCWD, out->name,
+                   AT_SYMLINK_FOLLOW) == 0) {
+            fd = out->next_fd;
+        } else {
+            close(out->next_fd);
+        }
+        out->next_fd = -1;
+    }
+
+    if (fd == -1) {
+        out->next_allocated = 0;
+        fd = open(out->name, O_CREAT | O_WRONLY | O_TRUNC,
+                  S_IRWXU | S_IRWXG | S_IRWXO);
+        if (fd == -1) {
+            return -1;
+        }
+    }
+
+    close(out->fd);
+    if (attach(out, fd, 0) == -1) {
+        return -1;
+    }
+    out->allocated = out->next_allocated;
+    out->next_allocated = 0;
+
+    prepare_next(out);
+    return 0;
+}
+
+/* Carry on in whatever is now under the file's name, after a SIGHUP */
+static int reopen(struct outfile *out)
+{
+    struct stat st;
+    int fd;
+
+    out->reopens = reopen_requests;
+    if (finish(out) == -1) {
+        return -1;
+    }
+
+    fd = open(out->name, O_CREAT | O_WRONLY | O_APPEND,
+              S_IRWXU | S_IRWXG | S_IRWXO);
+    if (fd == -1) {
+        return -1;
+    }
+
+    close(out->fd);
+    if (fstat(fd, &st) == -1) {
+        out->fd = fd;
+        return -1;
+    }
+
+    return attach(out, fd, st.st_size);
+}
+
+void outfile_request_reopen(void)
+{
+    reopen_requests++;
+}
+
+void outfile_wrap(struct outfile *out, int fd, const char *name)
+{
+    memset(out, 0, sizeof(*out));
+    out->fd = fd;
+    out->name = name;
+    out->next_fd = -1;
+}
+
+int outfile_open(struct outfile *out, const char *name, int flags,
+                 const struct outfile_options *options)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(name, O_CREAT | O_WRONLY | flags,
+              S_IRWXU | S_IRWXG | S_IRWXO);
+    outfile_wrap(out, fd, name);
+    if (fd == -1) {
+        return -1;
+    }
+
+    out->options = options;
+    if (options == NULL || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    attach(out, fd, (flags & O_APPEND) ? (unsigned long long)st.st_size : 0);
+
+    if (options->direct) {
+        setup_direct(out, &st);
+    }
+    if (options->prealloc > 0) {
+        out->features |= OUTFILE_PREALLOC;
+    }
+
+    /* With O_DIRECT there are no dirty pages to flush */
+    if (options->writebehind > 0 && !(out->features & OUTFILE_DIRECT)) {
+        out->features |= OUTFILE_WRITEBEHIND;
+    }
+
+    if (options->rotate > 0) {
+        out->rotated = malloc(strlen(name) + 24);
+        if (out->rotated != NULL) {
+            out->features |= OUTFILE_ROTATE;
+            find_segment(out);
+            prepare_next(out);
+        }
+    }
+
+    if (options->reopen) {
+        out->features |= OUTFILE_REOPEN;
+        out->reopens = reopen_requests;
+    }
+
+    return 0;
+}
+
+/* Write to the file as it is, without rotating it */
+static int write_segment(struct outfile *out, const char *buf, size_t len)
+{
+    size_t n;
+
+    if (out->features & OUTFILE_DIRECT) {
+        while (len > 0) {
+            n = out->stage.size - out->staged;
+            if (n > len) {
+                n = len;
+            }
+
+            memcpy(out->stage.data + out->staged, buf, n);
+            out->staged += n;
+            buf += n;
+            len -= n;
+
+            if (out->staged == out->stage.size && stage_flush(out, 0) == -1) {
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    if (out->features & OUTFILE_PREALLOC) {
+        prealloc(out, len);
+    }
+
+    if (write_all(out, buf, len) == -1) {
+        return -1;
+    }
+    out->offset += len;
+
+    if (out->features & OUTFILE_WRITEBEHIND) {
+        return write_behind(out);
+    }
+
+    return 0;
+}
+
+int outfile_write(struct outfile *out, const char *buf, size_t len)
+{
+    unsigned long long size;
+    size_t n;
+
+    if ((out->features & OUTFILE_REOPEN) && out->reopens != reopen_requests &&
+        reopen(out) == -1) {
+        return -1;
+    }
+
+    if (!(out->features & OUTFILE_ROTATE)) {
+        return write_segment(out, buf, len);
+    }
+
+    /* Split the data so that each segment ends exactly at the threshold */
+    while (len > 0) {
+        size = out->offset + out->staged;
+        if (size >= out->options->rotate) {
+            if (rotate(out) == -1) {
+                return -1;
+            }
+            size = 0;
+        }
+
+        n = len;
+        if (n > out->options->rotate - size) {
+            n = out->options->rotate - size;
+        }
+
+        if (write_segment(out, buf, n) == -1) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int outfile_close(struct outfile *out)
+{
+    int retval = 0;
+    int error = 0;
+
+    if (out->fd == -1) {
+        return 0;
+    }
+
+    if (finish(out) == -1) {
+        error = errno;
+        retval = -1;
+    }
+
+    close(out->fd);
+    out->fd = -1;
+    if (out->next_fd != -1) {
+        close(out->next_fd);
+        out->next_fd = -1;
+    }
+
+    iobuf_free(&out->stage);
+    free(out->rotated);
+    out->rotated = NULL;
+    out->features = 0;
+
+    errno = error;
+    return retval;
+}
@@ -0,0 +1,98 @@
+#ifndef POSIXY_OUTFILE_H
+#define POSIXY_OUTFILE_H
+
+#include <signal.h>
+
+#include "iobuf.h"
+#include "stats.h"
+
+/*
+ * File output for tee, with optional handling for long streams to disk: to
+ * keep them from building up dirty pages in the page cache, and to rotate
+ * them. The options only apply to regular files, anything else is written
+ * as it is.
+ *
+ *  direct      Write with O_DIRECT from an aligned staging buffer. An
+ *              unaligned start (with -a) and the unaligned tail at the end
+ *              are written through the page cache.
+ *  prealloc    Allocate the file in extents of this many bytes ahead of the
+ *              data, without changing its size. Whatever is left over is
+ *              released when the file is closed.
+ *  writebehind Start writeback of every this many bytes as soon as they are
+ *              written, and wait for the previous window, so that dirty
+ *              pages are flushed steadily rather than in bursts.
+ *  rotate      Once the file has this many bytes, rename it to the next of
+ *              file.1, file.2 and so on, and carry on in a new file. The new
+ *              file is created and allocated ahead of time, so that the
+ *              switch is just a rename and a link.
+ *  reopen      Reopen the file by name, appending to it, on the first write
+ *              after outfile_request_reopen, for external log rotation.
+ */
+struct outfile_options {
+    int direct;
+    unsigned long long prealloc;
+    unsigned long long writebehind;
+    unsigned long long rotate;
+    int reopen;
+};
+
+/* Options in use on an output */
+#define OUTFILE_DIRECT          0x1
+#define OUTFILE_PREALLOC        0x2
+#define OUTFILE_WRITEBEHIND     0x4
+#define OUTFILE_ROTATE          0x8
+#define OUTFILE_REOPEN          0x10
+
+struct outfile {
+    int fd;                         /* -1 if not open */
+    const char *name;
+    int features;                   /* OUTFILE_* */
+    const struct outfile_options *options;
+
+    unsigned long long offset;      /* Bytes written so far */
+    unsigned long long allocated;   /* End of the preallocated space */
+    unsigned long long flushed;     /* End of the last window flushed */
+    unsigned long long synced;      /* End of the last window waited for */
+
+    struct iobuf stage;             /* Staging buffer for O_DIRECT */
+    size_t staged;
+    size_t align;
+
+    char *rotated;                  /* Space for the names of segments */
+    unsigned long segment;          /* Number of the next segment */
+    int next_fd;                    /* Next file, created ahead of time */
+    unsigned long long next_allocated;
+    sig_atomic_t reopens;           /* Reopen requests seen */
+
+    struct stats_stream *stats;     /* Counters, or NULL */
+};
+
+/*
+ * Open a file for writing with the given extra open flags, such as O_TRUNC
+ * or O_APPEND, and set up the options where they can be used. Options that
+ * the file system doesn't support are quietly dropped. Returns -1 with
+ * errno set if the file can't be opened.
+ */
+int outfile_open(struct outfile *out, const char *name, int flags,
+                 const struct outfile_options *options);
+
+/* Set up an output for a descriptor that is already open, with no options */
+void outfile_wrap(struct outfile *out, int fd, const char *name);
+
+/*
+ * Ask all the files with the reopen option to reopen before their next
+ * write. This is safe to call from a signal handler.
+ */
+void outfile_request_reopen(void);
+
+/* Write all of buf, returns -1 with errno set on error */
+int outfile_write(struct outfile *out, const char *buf, size_t len);
+
+/*
+ * Write out anything still staged and close the file. Returns -1 with errno
+ * set if the last of the data couldn't be written. The file is closed
+ * either way.
+ */
+int outfile_close(struct outfile *out);
+
+#endif /* POSIXY_OUTFILE_H */
@@ -0,0 +1,131 @@
+/*
+ * Splitting of pathnames for basename and dirname, see pathname.h
+ */
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "pathname.h"
+
+/* Runs shorter than this are scanned a byte at a time */
+#define SCALAR_MAX      16
+
+/*
+ * Scan backwards from end for the last byte that is a slash, if slash is
+ * set, or that isn't. Returns the offset just past it, or 0 if there is
+ * none. The vector loops compare a block ending at end, so that the match
+ * closest to the end is the highest bit of the mask.
+ */
+static inline __attribute__((always_inline))
+size_t scan_scalar(const char *path, size_t end, int slash)
+{
+    while (end > 0 && (path[end - 1] == '/') != slash) {
+        end--;
+    }
+
+    return end;
+}
+
+#ifdef __SSE2__
+static inline __attribute__((always_inline))
+size_t scan_sse2(const char *path, size_t end, int slash)
+{
+    const __m128i slashes = _mm_set1_epi8('/');
+    uint32_t mask;
+
+    while (end >= SCALAR_MAX) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                   _mm_loadu_si128((const __m128i *)(path + end - 16)),
+                   slashes));
+        if (!slash) {
+            mask ^= 0xffff;
+        }
+        if (mask) {
+            return end - 16 + (32 - __builtin_clz(mask));
+        }
+        end -= 16;
+    }
+
+    return scan_scalar(path, end, slash);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PATHNAME_AVX2
+
+static inline __attribute__((always_inline, target("avx2")))
+size_t scan_avx2(const char *path, size_t end, int slash)
+{
+    const __m256i slashes = _mm256_set1_epi8('/');
+    uint32_t mask;
+
+    while (end >= 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                   _mm256_loadu_si256((const __m256i *)(path + end - 32)),
+                   slashes));
+        if (!slash) {
+            mask = ~mask;
+        }
+        if (mask) {
+            return end - 32 + (32 - __builtin_clz(mask));
+        }
+        end -= 32;
+    }
+
+    return scan_sse2(path, end, slash);
+}
+#endif
+
+/*
+ * The pass itself, one instance for each kind of scan: the trailing
+ * slashes, then the last component, then the slashes before it.
+ */
+#define PATHNAME_SPLIT(scan)                                                \
+    split->base_end = scan(path, len, 0);                                   \
+    if (split->base_end == 0) {                                             \
+        split->base_start = split->dir_end = 0;                             \
+        return;                                                             \
+    }                                                                       \
+    split->base_start = scan(path, split->base_end, 1);                     \
+    split->dir_end = scan(path, split->base_start, 0);
+
+#ifdef PATHNAME_AVX2
+__attribute__((target("avx2")))
+static void split_avx2(const char *path, size_t len, struct pathname *split)
+{
+    PATHNAME_SPLIT(scan_avx2)
+}
+#endif
+
+static void split_default(const char *path, size_t len,
+                          struct pathname *split)
+{
+#ifdef __SSE2__
+    PATHNAME_SPLIT(scan_sse2)
+#else
+    PATHNAME_SPLIT(scan_scalar)
+#endif
+}
+
+void pathname_split(const char *path, size_t len, struct pathname *split)
+{
+#ifdef PATHNAME_AVX2
+    static int avx2 = -1;
+
+    /* Most paths are short enough that the wider vectors don't matter */
+    if (len >= 64) {
+        if (avx2 == -1) {
+            __builtin_cpu_init();
+            avx2 = __builtin_cpu_supports("avx2");
+        }
+        if (avx2) {
+            split_avx2(path, len, split);
+            return;
+        }
+    }
+#endif
+
+    split_default(path, len, split);
+}
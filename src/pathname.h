@@ -0,0 +1,26 @@
+#ifndef POSIXY_PATHNAME_H
+#define POSIXY_PATHNAME_H
+
+#include <stddef.h>
+
+/*
+ * Splitting of pathnames for basename and dirname
+ *
+ * A pathname is split in place, in one pass backwards from its end, into
+ * the last component and the directory before it. Nothing is allocated, and
+ * the pathname need not be terminated. Long runs of bytes are scanned 16 or
+ * 32 bytes at a time with SSE2 or AVX2, where the CPU has them.
+ *
+ * For "/usr//lib//", base_start is 6, base_end is 9 and dir_end is 4. For
+ * a pathname that is empty or all slashes, all three are 0. For a pathname
+ * with a single component, such as "lib/", dir_end and base_start are 0.
+ */
+struct pathname {
+    size_t dir_end;                 /* End of the directory, less slashes */
+    size_t base_start;              /* Start of the last component */
+    size_t base_end;                /* End of it, less trailing slashes */
+};
+
+void pathname_split(const char *path, size_t len, struct pathname *split);
+
+#endif /* POSIXY_PATHNAME_H */
@@ -0,0 +1,21 @@
+#ifndef POSIXY_H
+#define POSIXY_H
+
+typedef int (*handler_function)(int, char**);
+
+/* Entry in the dispatch table, mapping a command name to its handler */
+struct handler {
+    const char *name;
+    handler_function func;
+};
+
+/* Run the handler selected by argv[0], or argv[1] if invoked as posixy */
+int posixy_dispatch(int argc, char **argv);
+
+/* Reset process-global state between handlers run in the same process */
+void posixy_reset(void);
+
+/* Run commands read from a file or stdin, argv[0] is "--batch" */
+int posixy_batch(int argc, char **argv);
+
+#endif /* POSIXY_H */
@@ -0,0 +1,259 @@
+/*
+ * Streaming of delimited records, see records.h
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "iobuf.h"
+#include "records.h"
+
+/* Size of the input and output buffers, the input grows for long records */
+#define RECORDS_BUFFER      IOBUF_DEFAULT_MAX
+
+/* Results up to this long are copied with fixed size loads and stores */
+#define SHORT_COPY          32
+
+struct records_output {
+    int fd;
+    struct iobuf buf;
+    size_t used;
+    int error;                      /* errno of a failed write, or 0 */
+    const char *input;              /* The input buffer, where most results */
+    const char *input_end;          /* point, less SHORT_COPY bytes */
+};
+
+static int write_all(struct records_output *out, const char *data, size_t len)
+{
+    ssize_t written;
+
+    while (len > 0) {
+        written = write(out->fd, data, len);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written == -1) {
+            out->error = errno;
+            return -1;
+        }
+
+        data += written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+static int flush(struct records_output *out)
+{
+    size_t used = out->used;
+
+    out->used = 0;
+    return write_all(out, out->buf.data, used);
+}
+
+/*
+ * Append a result and the delimiter to the output. Most results are short
+ * and point into the input buffer, which is padded at the end, so that they
+ * can be copied without a call to memcpy, which costs more than the copy.
+ */
+static inline int emit(struct records_output *out, const char *result,
+                       size_t len, char delimiter)
+{
+    char *dest = out->buf.data + out->used;
+
+#ifdef __SSE2__
+    if (len <= SHORT_COPY && result >= out->input &&
+        result < out->input_end &&
+        out->buf.size - out->used > SHORT_COPY) {
+        _mm_storeu_si128((__m128i *)dest,
+                         _mm_loadu_si128((const __m128i *)result));
+        _mm_storeu_si128((__m128i *)(dest + 16),
+                         _mm_loadu_si128((const __m128i *)(result + 16)));
+        dest[len] = delimiter;
+        out->used += len + 1;
+        return 0;
+    }
+#endif
+
+    if (len + 1 > out->buf.size - out->used) {
+        if (flush(out) == -1) {
+            return -1;
+        }
+
+        /* Too long to buffer, write it out as it is */
+        if (len + 1 > out->buf.size) {
+            if (write_all(out, result, len) == -1) {
+                return -1;
+            }
+            len = 0;
+        }
+    }
+
+    dest = out->buf.data + out->used;
+    memcpy(dest, result, len);
+    dest[len] = delimiter;
+    out->used += len + 1;
+    return 0;
+}
+
+/*
+ * Map and emit all the complete records in [start, end). Returns the start
+ * of the partial record left over, or NULL on a write error.
+ *
+ * Records such as paths are short, so a call to memchr for each would cost
+ * more than the rest of the work. With SSE2, the delimiters are found 16
+ * bytes at a time instead, and every record ending in the block is handled
+ * from the bit mask.
+ */
+static char *map_block(char *start, char *end, char delimiter,
+                       records_function map, void *arg,
+                       struct records_output *out)
+{
+    const char *result;
+    size_t result_len;
+    char *record = start;
+    char *next;
+#ifdef __SSE2__
+    __m128i delimiters = _mm_set1_epi8(delimiter);
+    unsigned int mask;
+    char *block;
+
+    for (block = start; end - block >= 16; block += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                   _mm_loadu_si128((const __m128i *)block), delimiters));
+
+        while (mask) {
+            next = block + __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            result = map(record, next - record, &result_len, arg);
+            if (emit(out, result, result_len, delimiter) == -1) {
+                return NULL;
+            }
+            record = next + 1;
+        }
+    }
+    start = block;
+#endif
+
+    while ((next = memchr(start, delimiter, end - start)) != NULL) {
+        result = map(record, next - record, &result_len, arg);
+        if (emit(out, result, result_len, delimiter) == -1) {
+            return NULL;
+        }
+        record = start = next + 1;
+    }
+
+    return record;
+}
+
+/* Note where the input buffer is, for emit */
+static void set_input(struct records_output *out, const struct iobuf *in)
+{
+    out->input = in->data;
+    out->input_end = in->data + in->size - SHORT_COPY;
+}
+
+/* Double the size of the input buffer, keeping the first used bytes */
+static int grow(struct iobuf *in, size_t used)
+{
+    struct iobuf bigger = { NULL, 0, 0 };
+
+    if (iobuf_alloc(&bigger, in->size * 2) == -1) {
+        return -1;
+    }
+
+    memcpy(bigger.data, in->data, used);
+    iobuf_free(in);
+    *in = bigger;
+    return 0;
+}
+
+int records_map(int in_fd, int out_fd, int delimiter, records_function map,
+                void *arg, const char *program)
+{
+    struct records_output out;
+    struct iobuf in;
+    const char *result;
+    size_t result_len;
+    size_t have = 0;
+    char *start;
+    char *end;
+    ssize_t got;
+    int retval = 1;
+
+    memset(&out, 0, sizeof(out));
+    memset(&in, 0, sizeof(in));
+    out.fd = out_fd;
+
+    if (iobuf_alloc(&in, RECORDS_BUFFER) == -1 ||
+        iobuf_alloc(&out.buf, RECORDS_BUFFER) == -1) {
+        fprintf(stderr, "%s: %s\n", program, strerror(errno));
+        goto out;
+    }
+    set_input(&out, &in);
+
+    /* In posixy --batch, earlier commands may have left output in stdio */
+    fflush(stdout);
+
+    /* The last SHORT_COPY bytes of the input buffer are kept as padding */
+    for (;;) {
+        got = read(in_fd, in.data + have, in.size - SHORT_COPY - have);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        } else if (got == -1) {
+            fprintf(stderr, "%s: stdin: %s\n", program, strerror(errno));
+            goto out;
+        }
+
+        end = in.data + have + got;
+        start = map_block(in.data, end, delimiter, map, arg, &out);
+        if (start == NULL) {
+            goto write_error;
+        }
+
+        if (got == 0) {
+            /* The last record, without a delimiter */
+            if (start < end) {
+                result = map(start, end - start, &result_len, arg);
+                if (emit(&out, result, result_len, delimiter) == -1) {
+                    goto write_error;
+                }
+            }
+            break;
+        }
+
+        /* Move the partial record to the front, or make room for it */
+        have = end - start;
+        if (start != in.data) {
+            memmove(in.data, start, have);
+        } else if (have == in.size - SHORT_COPY) {
+            if (grow(&in, have) == -1) {
+                fprintf(stderr, "%s: %s\n", program, strerror(errno));
+                goto out;
+            }
+            set_input(&out, &in);
+        }
+    }
+
+    if (flush(&out) == -1) {
+        goto write_error;
+    }
+
+    retval = 0;
+    goto out;
+
+write_error:
+    fprintf(stderr, "%s: stdout: %s\n", program, strerror(out.error));
+
+out:
+    iobuf_free(&in);
+    iobuf_free(&out.buf);
+    return retval;
+}
@@ -0,0 +1,33 @@
+#ifndef POSIXY_RECORDS_H
+#define POSIXY_RECORDS_H
+
+#include <stddef.h>
+
+/*
+ * Streaming of delimited records, for the utilities that take one string
+ * per process, such as basename and dirname
+ *
+ * Records are read from a large input buffer, separated by a delimiter such
+ * as newline or NUL, and each is mapped to a result, which is written
+ * through one output buffer, followed by the same delimiter. The last
+ * record doesn't need a delimiter. Nothing is allocated per record, and
+ * stdio isn't involved.
+ */
+
+/*
+ * Map a record of len bytes, which is not terminated, to a result of
+ * *result_len bytes. The result may point into the record, or elsewhere as
+ * long as it lasts until the next call.
+ */
+typedef const char *(*records_function)(const char *record, size_t len,
+                                        size_t *result_len, void *arg);
+
+/*
+ * Map each record read from in_fd and write the results to out_fd. Returns
+ * 0 on success, or 1 after reporting an error on stderr, prefixed with the
+ * program name.
+ */
+int records_map(int in_fd, int out_fd, int delimiter, records_function map,
+                void *arg, const char *program);
+
+#endif /* POSIXY_RECORDS_H */
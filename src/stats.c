@@ -0,0 +1,300 @@
+/*
+ * Counters for the copy loops in cat and tee, see stats.h
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "stats.h"
+
+static struct {
+    const char *program;
+    const char *path;               /* POSIXY_STATS, or NULL */
+    int enabled;
+    unsigned long long start;
+    struct stats_stream *streams;
+    struct stats_stream **tail;
+    int signal_set;                 /* SIGUSR1 is ours until stats_finish */
+    struct sigaction old_action;
+} stats;
+
+/* Set by the SIGUSR1 handler, cleared by whoever writes out the counters */
+static volatile sig_atomic_t dump_requested;
+
+static void stats_signal_handler(int signal)
+{
+    (void)signal;
+    dump_requested = 1;
+}
+
+/* Append a string to buf, keeping track of the space left */
+static void append(char *buf, size_t size, size_t *used, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void append(char *buf, size_t size, size_t *used, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (*used >= size) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf + *used, size - *used, fmt, ap);
+    va_end(ap);
+
+    if (len > 0) {
+        *used += len;
+    }
+}
+
+/* Append a string as JSON, escaping what needs escaping */
+static void append_string(char *buf, size_t size, size_t *used,
+                          const char *str)
+{
+    append(buf, size, used, "\"");
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            append(buf, size, used, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            append(buf, size, used, "\\u%04x", (unsigned char)*str);
+        } else {
+            append(buf, size, used, "%c", *str);
+        }
+    }
+    append(buf, size, used, "\"");
+}
+
+/* Write the counters to fd as one line of JSON */
+static void stats_dump(int fd)
+{
+    struct stats_stream *s;
+    size_t size = 4096;
+    size_t used;
+    char *buf;
+    const char *sep;
+    ssize_t written;
+    int i;
+
+    /* Each stream needs well under 2K, make sure there is room */
+    for (s = stats.streams; s; s = s->next) {
+        size += 2048 + strlen(s->name) * 6;
+    }
+
+    buf = malloc(size);
+    if (buf == NULL) {
+        return;
+    }
+
+    used = 0;
+    append(buf, size, &used, "{\"program\": ");
+    append_string(buf, size, &used, stats.program);
+    append(buf, size, &used, ", \"pid\": %ld, \"elapsed_ns\": %llu, "
+           "\"streams\": [", (long)getpid(), stats_now() - stats.start);
+
+    for (s = stats.streams; s; s = s->next) {
+        append(buf, size, &used, "%s{\"name\": ",
+               s == stats.streams ? "" : ", ");
+        append_string(buf, size, &used, s->name);
+        append(buf, size, &used, ", \"bytes_in\": %llu, \"bytes_out\": %llu, "
+               "\"reads\": %llu, \"writes\": %llu, \"copies\": %llu, "
+               "\"short_writes\": %llu, \"eintr\": %llu, \"errors\": %llu, "
+               "\"write_latency_ns\": {",
+               s->bytes_in, s->bytes_out, s->reads, s->writes, s->copies,
+               s->short_writes, s->eintr, s->errors);
+
+        /* Only the buckets in use, keyed by their lower bound */
+        sep = "";
+        for (i = 0; i < STATS_BUCKETS; i++) {
+            if (s->latency[i]) {
+                append(buf, size, &used, "%s\"%llu\": %llu", sep,
+                       i ? 1ULL << i : 0, s->latency[i]);
+                sep = ", ";
+            }
+        }
+        append(buf, size, &used, "}}");
+    }
+    append(buf, size, &used, "]}\n");
+
+    /* One write, so that lines from several processes don't interleave */
+    if (used < size) {
+        do {
+            written = write(fd, buf, used);
+        } while (written == -1 && errno == EINTR);
+    }
+
+    free(buf);
+}
+
+/* Write out the counters if SIGUSR1 asked for them */
+static void stats_poll(void)
+{
+    if (dump_requested &&
+        __atomic_exchange_n(&dump_requested, 0, __ATOMIC_ACQ_REL)) {
+        stats_dump(STDERR_FILENO);
+    }
+}
+
+void stats_init(const char *program)
+{
+    struct sigaction sa;
+    char *env;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.tail = &stats.streams;
+    stats.program = program;
+    dump_requested = 0;
+
+    stats.path = getenv("POSIXY_STATS");
+    if (stats.path && *stats.path == '\0') {
+        stats.path = NULL;
+    }
+
+    env = getenv("POSIXY_STATS_SIGNAL");
+    if (env && strcmp(env, "1") == 0) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stats_signal_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        if (sigaction(SIGUSR1, &sa, &stats.old_action) == 0) {
+            stats.signal_set = 1;
+        }
+        stats.enabled = 1;
+    }
+
+    if (stats.path) {
+        stats.enabled = 1;
+    }
+
+    stats.start = stats_now();
+}
+
+struct stats_stream *stats_stream(const char *name)
+{
+    struct stats_stream *s;
+
+    if (!stats.enabled) {
+        return NULL;
+    }
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return NULL;
+    }
+
+    s->name = name;
+    *stats.tail = s;
+    stats.tail = &s->next;
+    return s;
+}
+
+void stats_finish(void)
+{
+    struct stats_stream *s;
+    struct stats_stream *next;
+    int fd;
+
+    /* Later commands in posixy --batch get SIGUSR1 back as it was */
+    if (stats.signal_set) {
+        sigaction(SIGUSR1, &stats.old_action, NULL);
+        stats.signal_set = 0;
+    }
+
+    if (stats.path) {
+        fd = open(stats.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+        if (fd != -1) {
+            stats_dump(fd);
+            close(fd);
+        }
+    }
+
+    for (s = stats.streams; s; s = next) {
+        next = s->next;
+        free(s);
+    }
+
+    stats.streams = NULL;
+    stats.tail = &stats.streams;
+    stats.enabled = 0;
+}
+
+/* Power of two bucket for a latency in nanoseconds */
+static int bucket(unsigned long long ns)
+{
+    int i = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    return i < STATS_BUCKETS ? i : STATS_BUCKETS - 1;
+}
+
+void stats_read_done(struct stats_stream *s, ssize_t result)
+{
+    int error = errno;
+
+    s->reads++;
+    if (result > 0) {
+        s->bytes_in += result;
+    } else if (result == -1) {
+        if (error == EINTR) {
+            s->eintr++;
+        } else {
+            s->errors++;
+        }
+    }
+
+    stats_poll();
+    errno = error;
+}
+
+void stats_write_done(struct stats_stream *s, unsigned long long start,
+                      ssize_t result, size_t len)
+{
+    int error = errno;
+
+    s->writes++;
+    s->latency[bucket(stats_now() - start)]++;
+    if (result >= 0) {
+        s->bytes_out += result;
+        if ((size_t)result < len) {
+            s->short_writes++;
+        }
+    } else if (error == EINTR) {
+        s->eintr++;
+    } else {
+        s->errors++;
+    }
+
+    stats_poll();
+    errno = error;
+}
+
+void stats_copy_done(struct stats_stream *in, struct stats_stream *out,
+                     unsigned long long start, ssize_t result)
+{
+    int error = errno;
+
+    if (out) {
+        out->copies++;
+        out->latency[bucket(stats_now() - start)]++;
+        if (result > 0) {
+            out->bytes_out += result;
+        } else if (result == -1 && error == EINTR) {
+            out->eintr++;
+        } else if (result == -1) {
+            out->errors++;
+        }
+    }
+
+    if (in && result > 0) {
+        in->bytes_in += result;
+    }
+
+    stats_poll();
+    errno = error;
+}
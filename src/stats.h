@@ -0,0 +1,112 @@
+#ifndef POSIXY_STATS_H
+#define POSIXY_STATS_H
+
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/*
+ * Counters for the copy loops in cat and tee, for finding out which output
+ * or which system call is holding up a pipeline
+ *
+ * Each stream (stdin, stdout, a file) counts its bytes, system calls, short
+ * writes, EINTR retries and errors, and keeps a histogram of write latency
+ * in power of two buckets of nanoseconds. Counting is enabled by either of
+ * these environment variables:
+ *
+ *  POSIXY_STATS        append the counters to this file as a line of JSON
+ *                      when the utility finishes
+ *  POSIXY_STATS_SIGNAL set to 1 to write the counters to stderr as a line of
+ *                      JSON on SIGUSR1, as dd does
+ *
+ * The SIGUSR1 handler only sets a flag, and the counters are written out on
+ * the next system call that is counted. With counting disabled, the streams
+ * are NULL, and the wrappers below go straight to the system call.
+ */
+
+/* Buckets of write latency, the last one also counts anything longer */
+#define STATS_BUCKETS       32
+
+struct stats_stream {
+    const char *name;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long reads;
+    unsigned long long writes;
+    unsigned long long copies;          /* copy_file_range, splice, etc. */
+    unsigned long long short_writes;
+    unsigned long long eintr;
+    unsigned long long errors;
+    unsigned long long latency[STATS_BUCKETS];
+    struct stats_stream *next;
+};
+
+/*
+ * Set up counting for the given utility, if it is enabled. This is called
+ * on entry to the handler, so that each command in posixy --batch starts
+ * afresh.
+ */
+void stats_init(const char *program);
+
+/* Add a stream, returns NULL if counting is disabled or on error */
+struct stats_stream *stats_stream(const char *name);
+
+/* Write out the counters to POSIXY_STATS, and release the streams */
+void stats_finish(void);
+
+/*
+ * Record the result of a system call, started at the given time for the
+ * latency histogram. A copy counts as a read on in and a write on out,
+ * either of which may be NULL.
+ */
+void stats_read_done(struct stats_stream *s, ssize_t result);
+void stats_write_done(struct stats_stream *s, unsigned long long start,
+                      ssize_t result, size_t len);
+void stats_copy_done(struct stats_stream *in, struct stats_stream *out,
+                     unsigned long long start, ssize_t result);
+
+/* Monotonic time in nanoseconds */
+static inline unsigned long long stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Start timing a system call on the stream, 0 if it is not counted */
+static inline unsigned long long stats_begin(struct stats_stream *s)
+{
+    return s ? stats_now() : 0;
+}
+
+/* read(2) and write(2), counted on the stream */
+static inline ssize_t stats_read(struct stats_stream *s, int fd, void *buf,
+                                 size_t len)
+{
+    ssize_t result = read(fd, buf, len);
+
+    if (s) {
+        stats_read_done(s, result);
+    }
+    return result;
+}
+
+static inline ssize_t stats_write(struct stats_stream *s, int fd,
+                                  const void *buf, size_t len)
+{
+    unsigned long long start;
+    ssize_t result;
+
+    if (s == NULL) {
+        return write(fd, buf, len);
+    }
+
+    start = stats_now();
+    result = write(fd, buf, len);
+    stats_write_done(s, start, result, len);
+    return result;
+}
+
+#endif /* POSIXY_STATS_H */
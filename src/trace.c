@@ -0,0 +1,234 @@
+/*
+ * Tracing of handler calls in the dispatcher, see trace.h
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#endif
+
+#include "trace.h"
+
+/* Perf events counted, in the order of the fields in the record */
+#define TRACE_COUNTERS      3
+
+static struct {
+    const char *path;
+    int at_exit;
+    int counters[TRACE_COUNTERS];
+    uint64_t counter_base[TRACE_COUNTERS];
+    struct rusage usage_base;
+    int dispatched;
+    int returned;
+    uint64_t dispatch_time;
+    uint64_t return_time;
+    struct trace_record record;
+} trace;
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t timeval_us(const struct timeval *tv)
+{
+    return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+/*
+ * Count cycles, instructions and page faults in user space for this
+ * process. Anything that the kernel doesn't permit, for example with
+ * perf_event_paranoid set to 3 or in a VM without a PMU, is left out.
+ */
+static void open_counters(void)
+{
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(__NR_perf_event_open)
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[TRACE_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    };
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < TRACE_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        trace.counters[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1,
+                                    PERF_FLAG_FD_CLOEXEC);
+    }
+#else
+    int i;
+
+    for (i = 0; i < TRACE_COUNTERS; i++) {
+        trace.counters[i] = -1;
+    }
+#endif
+}
+
+static uint64_t read_counter(int i)
+{
+    uint64_t value;
+
+    if (trace.counters[i] == -1 ||
+        read(trace.counters[i], &value, sizeof(value)) != sizeof(value)) {
+        return TRACE_UNAVAILABLE;
+    }
+
+    return value;
+}
+
+/* Fill in the counters and resource usage since the base, and append it */
+static void write_record(void)
+{
+    struct trace_record *r = &trace.record;
+    struct rusage usage;
+    uint64_t *counters[TRACE_COUNTERS] = {
+        &r->cycles, &r->instructions, &r->page_faults
+    };
+    uint64_t value;
+    ssize_t written;
+    int fd;
+    int i;
+
+    getrusage(RUSAGE_SELF, &usage);
+    r->user_us = timeval_us(&usage.ru_utime) -
+                 timeval_us(&trace.usage_base.ru_utime);
+    r->system_us = timeval_us(&usage.ru_stime) -
+                   timeval_us(&trace.usage_base.ru_stime);
+    r->max_rss_kb = usage.ru_maxrss;
+    r->minor_faults = usage.ru_minflt - trace.usage_base.ru_minflt;
+    r->major_faults = usage.ru_majflt - trace.usage_base.ru_majflt;
+    r->voluntary_switches = usage.ru_nvcsw - trace.usage_base.ru_nvcsw;
+    r->involuntary_switches = usage.ru_nivcsw - trace.usage_base.ru_nivcsw;
+
+    for (i = 0; i < TRACE_COUNTERS; i++) {
+        value = read_counter(i);
+        if (value != TRACE_UNAVAILABLE &&
+            trace.counter_base[i] != TRACE_UNAVAILABLE) {
+            value -= trace.counter_base[i];
+        }
+        *counters[i] = value;
+    }
+
+    fd = open(trace.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        return;
+    }
+
+    do {
+        written = write(fd, r, sizeof(*r));
+    } while (written == -1 && errno == EINTR);
+
+    close(fd);
+}
+
+static void trace_exit(void)
+{
+    uint64_t now;
+
+    if (!trace.dispatched) {
+        return;
+    }
+
+    /* Flushing stdio is part of exiting, so do it before taking the time */
+    fflush(NULL);
+    now = clock_ns(CLOCK_MONOTONIC);
+
+    if (trace.returned) {
+        trace.record.exit_ns = now - trace.return_time;
+    } else {
+        /* The handler called exit() itself */
+        trace.record.handler_ns = now - trace.dispatch_time;
+    }
+
+    write_record();
+}
+
+void trace_init(int at_exit)
+{
+    memset(&trace, 0, sizeof(trace));
+
+    trace.path = getenv("POSIXY_TRACE");
+    if (trace.path == NULL || *trace.path == '\0') {
+        trace.path = NULL;
+        return;
+    }
+
+    trace.at_exit = at_exit;
+    open_counters();
+    if (at_exit) {
+        atexit(trace_exit);
+    }
+}
+
+void trace_dispatch(const char *command)
+{
+    struct trace_record *r = &trace.record;
+    int i;
+
+    if (trace.path == NULL) {
+        return;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->magic = TRACE_MAGIC;
+    r->version = TRACE_VERSION;
+    r->size = sizeof(*r);
+    strncpy(r->command, command, sizeof(r->command) - 1);
+    r->pid = getpid();
+    r->start_ns = clock_ns(CLOCK_REALTIME);
+
+    if (trace.at_exit) {
+        /* The whole process counts, from exec onwards */
+        r->exec_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+        for (i = 0; i < TRACE_COUNTERS; i++) {
+            trace.counter_base[i] = 0;
+        }
+    } else {
+        getrusage(RUSAGE_SELF, &trace.usage_base);
+        for (i = 0; i < TRACE_COUNTERS; i++) {
+            trace.counter_base[i] = read_counter(i);
+        }
+    }
+
+    trace.dispatched = 1;
+    trace.returned = 0;
+    trace.dispatch_time = clock_ns(CLOCK_MONOTONIC);
+}
+
+void trace_return(int status)
+{
+    if (trace.path == NULL) {
+        return;
+    }
+
+    trace.return_time = clock_ns(CLOCK_MONOTONIC);
+    trace.returned = 1;
+    trace.record.status = status;
+    trace.record.handler_ns = trace.return_time - trace.dispatch_time;
+
+    if (!trace.at_exit) {
+        write_record();
+        trace.dispatched = 0;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef POSIXY_TRACE_H
+#define POSIXY_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Tracing of handler calls in the dispatcher, enabled by setting
+ * POSIXY_TRACE to the path of a trace file
+ *
+ * Each handler call appends one fixed-size binary record to the file, in a
+ * single write with O_APPEND, so that any number of processes can share the
+ * file. The records are in native byte order, and are read back by
+ * posixy trace-report.
+ *
+ * For a command run on its own, the record is written at exit, and covers:
+ *
+ *  exec_ns     CPU time used by the process before the handler was called,
+ *              which covers execve, the dynamic loader and libc start-up
+ *  handler_ns  time spent in the handler
+ *  exit_ns     time from the handler returning to the process exiting,
+ *              including flushing stdio and the atexit handlers
+ *
+ * along with the resource usage of the whole process and, where the kernel
+ * permits, the cycles, instructions and page faults counted by perf events
+ * from the start of main. Counters that are not available are
+ * TRACE_UNAVAILABLE. In posixy --batch, there is a record for
+ * each command, written as soon as the handler returns, and the counters
+ * only cover the handler.
+ */
+
+#define TRACE_MAGIC         0x52545950      /* "PYTR" */
+#define TRACE_VERSION       1
+#define TRACE_UNAVAILABLE   UINT64_MAX
+
+struct trace_record {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;                  /* sizeof(struct trace_record) */
+    char command[16];               /* Truncated, and NUL terminated */
+    int32_t pid;
+    int32_t status;                 /* Handler return value */
+    uint64_t start_ns;              /* CLOCK_REALTIME when it was called */
+    uint64_t exec_ns;
+    uint64_t handler_ns;
+    uint64_t exit_ns;
+    uint64_t user_us;
+    uint64_t system_us;
+    uint64_t max_rss_kb;
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    uint64_t voluntary_switches;
+    uint64_t involuntary_switches;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t page_faults;
+};
+
+/*
+ * Set up tracing, if POSIXY_TRACE is set. If at_exit is set, the process
+ * runs a single command, and its record is written at exit.
+ */
+void trace_init(int at_exit);
+
+/* Called around each handler call by the dispatcher */
+void trace_dispatch(const char *command);
+void trace_return(int status);
+
+#endif /* POSIXY_TRACE_H */
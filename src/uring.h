@@ -0,0 +1,83 @@
+#ifndef POSIXY_URING_H
+#define POSIXY_URING_H
+
+/*
+ * Minimal io_uring wrapper, using the system calls directly so that no
+ * library is needed. Only available if configure found linux/io_uring.h.
+ */
+#ifdef HAVE_IO_URING
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+struct uring {
+    int fd;
+    unsigned int entries;
+    unsigned int features;      /* IORING_FEAT_* reported by the kernel */
+
+    /* Submission queue */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_local_tail;
+
+    /* Completion queue */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+/*
+ * Set up a ring with the given number of entries. Returns -1 with errno set
+ * if io_uring is not available, for example in seccomp-restricted
+ * containers or on older kernels.
+ */
+int uring_init(struct uring *ring, unsigned int entries);
+
+/* Tear down the ring */
+void uring_exit(struct uring *ring);
+
+/* Get a zeroed submission entry, or NULL if the queue is full */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/*
+ * Submit the queued entries, and wait until at least wait_nr completions
+ * are available. Returns the number of entries submitted, or -1.
+ */
+int uring_submit(struct uring *ring, unsigned int wait_nr);
+
+/* Get the next completion, or NULL if there is none */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+/* Mark the completion returned by uring_peek_cqe as consumed */
+void uring_cqe_seen(struct uring *ring);
+
+/* Register fixed buffers for use with IORING_OP_READ_FIXED/WRITE_FIXED */
+int uring_register_buffers(struct uring *ring, const struct iovec *iov,
+                           unsigned int count);
+
+/* Helper to fill in a read or write entry */
+static inline void uring_prep_rw(struct io_uring_sqe *sqe, int op, int fd,
+                                 const void *buf, unsigned int len,
+                                 long long offset)
+{
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = offset;
+}
+
+#endif /* HAVE_IO_URING */
+
+#endif /* POSIXY_URING_H */
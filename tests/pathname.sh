@@ -0,0 +1,266 @@
+#!/bin/sh
+# Check basename and dirname against the steps of POSIX, written out in sh
+# Usage: pathname.sh [path-to-posixy]
+#
+# The strings checked are every string of up to five of the characters a,
+# <period> and <slash>, a few longer ones with runs of slashes that take the
+# vector paths of pathname_split, and the cases listed in CASES. Each is
+# checked as an operand, with and without a suffix, and all of them at once
+# through the streaming mode, both with newlines and with -z. Operands and
+# suffixes that begin with '-' are checked too.
+#
+# Where POSIX leaves the result to the implementation, the reference does
+# what posixy does: basename of the null string is the null string, //
+# is processed like any other string of slashes, and dirname of the null
+# string is <period>, as a string with no slashes. Run by make check, with
+# POSIXY set to the posixy being built.
+
+set -u
+
+POSIXY="${1:-${POSIXY:-./posixy}}"
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+FAILURES=0
+
+# Remove any trailing slashes from $s
+strip_slashes() {
+    while :
+    do
+        case $s in
+        */) s=${s%/} ;;
+        *) break ;;
+        esac
+    done
+}
+
+# basename steps 1 to 6 on $1, with the suffix $2
+ref_basename() {
+    s=$1
+
+    # Step 1
+    if [ -z "$s" ]; then
+        printf '\n'
+        return
+    fi
+
+    # Steps 2 and 3
+    case $s in
+    *[!/]*) ;;
+    *) printf '/\n'; return ;;
+    esac
+
+    # Steps 4 and 5
+    strip_slashes
+    s=${s##*/}
+
+    # Step 6
+    if [ -n "$2" ] && [ "$s" != "$2" ]; then
+        case $s in
+        *"$2") s=${s%"$2"} ;;
+        esac
+    fi
+
+    printf '%s\n' "$s"
+}
+
+# dirname steps 1 to 8 on $1
+ref_dirname() {
+    s=$1
+
+    # Step 1
+    if [ "$s" != "//" ]; then
+        # Step 2
+        case $s in
+        "") ;;
+        *[!/]*) ;;
+        *) printf '/\n'; return ;;
+        esac
+
+        # Steps 3 and 4
+        strip_slashes
+        case $s in
+        */*) ;;
+        *) printf '.\n'; return ;;
+        esac
+
+        # Step 5
+        s=${s%"${s##*/}"}
+    fi
+
+    # Steps 6 to 8
+    strip_slashes
+    if [ -z "$s" ]; then
+        s=/
+    fi
+
+    printf '%s\n' "$s"
+}
+
+# Compare the output of a command with the expected output, in files
+check() {
+    if ! cmp -s "$WORKDIR/expected" "$WORKDIR/actual"; then
+        echo "FAIL: $*"
+        echo "  expected: $(od -An -c "$WORKDIR/expected")"
+        echo "  actual:   $(od -An -c "$WORKDIR/actual")"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# Build the strings of up to five characters, one per line
+: > "$WORKDIR/strings"
+set -- ""
+for length in 1 2 3 4 5
+do
+    for string in "$@"
+    do
+        printf '%s\n' "$string" >> "$WORKDIR/strings"
+    done
+
+    for string in "$@"
+    do
+        set -- "$@" "${string}a" "${string}." "${string}/"
+        shift
+    done
+done
+for string in "$@"
+do
+    printf '%s\n' "$string" >> "$WORKDIR/strings"
+done
+
+LONG=abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz0123
+SLASHES=////////////////////////////////////////////////////////////////
+CASES="/
+//
+a/
+usr//lib//
+//a//b//
+.
+..
+/usr/lib/libc.so
+$LONG
+$LONG/
+/$LONG$SLASHES
+$SLASHES
+$SLASHES$LONG
+$LONG$SLASHES$LONG$SLASHES
+$LONG/$LONG/$LONG
+$SLASHES$LONG/.$LONG$SLASHES"
+printf '%s\n' "$CASES" >> "$WORKDIR/strings"
+
+# Each string as an operand, then with the suffixes in SUFFIXES
+SUFFIXES="a .a / .so $LONG"
+while IFS= read -r string
+do
+    ref_basename "$string" "" > "$WORKDIR/expected"
+    "$POSIXY" basename "$string" > "$WORKDIR/actual"
+    check basename "'$string'"
+
+    ref_dirname "$string" > "$WORKDIR/expected"
+    "$POSIXY" dirname "$string" > "$WORKDIR/actual"
+    check dirname "'$string'"
+
+    for suffix in $SUFFIXES
+    do
+        ref_basename "$string" "$suffix" > "$WORKDIR/expected"
+        "$POSIXY" basename "$string" "$suffix" > "$WORKDIR/actual"
+        check basename "'$string'" "'$suffix'"
+    done
+done < "$WORKDIR/strings"
+
+# Arguments that begin with '-' are strings, as POSIX gives basename and
+# dirname no options. None of these is a list of options on its own, which
+# would select the streaming mode, so each is also checked without "--".
+DASHES="-
+-x
+-zx
+-foo/bar
+a-b
+-z/-s/
+---"
+for string in $DASHES
+do
+    ref_basename "$string" "" > "$WORKDIR/expected"
+    "$POSIXY" basename "$string" > "$WORKDIR/actual"
+    check basename "'$string'"
+
+    ref_dirname "$string" > "$WORKDIR/expected"
+    "$POSIXY" dirname "$string" > "$WORKDIR/actual"
+    check dirname "'$string'"
+
+    for suffix in -b -x -z -s -- /
+    do
+        ref_basename "$string" "$suffix" > "$WORKDIR/expected"
+        "$POSIXY" basename "$string" "$suffix" > "$WORKDIR/actual"
+        check basename "'$string'" "'$suffix'"
+    done
+done
+
+# A first argument of "--" ends the options, for any string
+for string in $DASHES -z -s --
+do
+    ref_basename "$string" "" > "$WORKDIR/expected"
+    "$POSIXY" basename -- "$string" > "$WORKDIR/actual"
+    check basename -- "'$string'"
+
+    ref_basename "$string" -z > "$WORKDIR/expected"
+    "$POSIXY" basename -- "$string" -z > "$WORKDIR/actual"
+    check basename -- "'$string'" -z
+
+    ref_dirname "$string" > "$WORKDIR/expected"
+    "$POSIXY" dirname -- "$string" > "$WORKDIR/actual"
+    check dirname -- "'$string'"
+done
+
+# All of the strings through the streaming mode, once per line and once
+# terminated by NUL, repeated to span more than one read
+i=0
+: > "$WORKDIR/input"
+while [ $i -lt 64 ]
+do
+    cat "$WORKDIR/strings" >> "$WORKDIR/input"
+    i=$((i + 1))
+done
+tr '\n' '\0' < "$WORKDIR/input" > "$WORKDIR/input-z"
+
+for suffix in "" .a
+do
+    while IFS= read -r string
+    do
+        ref_basename "$string" "$suffix"
+    done < "$WORKDIR/input" > "$WORKDIR/expected-lines"
+
+    cp "$WORKDIR/expected-lines" "$WORKDIR/expected"
+    "$POSIXY" basename ${suffix:+-s "$suffix"} < "$WORKDIR/input" \
+        > "$WORKDIR/actual"
+    check basename ${suffix:+-s "$suffix"} streaming
+
+    tr '\n' '\0' < "$WORKDIR/expected-lines" > "$WORKDIR/expected"
+    "$POSIXY" basename -z ${suffix:+-s "$suffix"} < "$WORKDIR/input-z" \
+        > "$WORKDIR/actual"
+    check basename -z ${suffix:+-s "$suffix"} streaming
+done
+
+while IFS= read -r string
+do
+    ref_dirname "$string"
+done < "$WORKDIR/input" > "$WORKDIR/expected-lines"
+
+cp "$WORKDIR/expected-lines" "$WORKDIR/expected"
+"$POSIXY" dirname < "$WORKDIR/input" > "$WORKDIR/actual"
+check dirname streaming
+
+tr '\n' '\0' < "$WORKDIR/expected-lines" > "$WORKDIR/expected"
+"$POSIXY" dirname -z < "$WORKDIR/input-z" > "$WORKDIR/actual"
+check dirname -z streaming
+
+# The last string needs no delimiter
+printf 'usr//lib//\0//a//b//' > "$WORKDIR/input-z"
+printf 'lib\0b\0' > "$WORKDIR/expected"
+"$POSIXY" basename -z < "$WORKDIR/input-z" > "$WORKDIR/actual"
+check basename -z unterminated
+
+if [ $FAILURES -ne 0 ]; then
+    echo "$FAILURES checks failed"
+    exit 1
+fi